@@ -1,19 +1,35 @@
 # Hacky build script for now so I don't have to decide whether to learn cmake, make or bazel.
 # If you'd like to replace this with something better, please feel free to!
-emcc \
-  src/cc/viz.cc \
-  src/cc/renderer.cc \
-  contrib/jsoncpp/src/lib_json/json_{writer,value}.cpp \
-  contrib/abseil-cpp/absl/strings/numbers.cc \
-  contrib/abseil-cpp/absl/strings/str_cat.cc \
-  -Icontrib/googletest/googletest/include \
-  -Icontrib/eigen \
-  -Icontrib/abseil-cpp \
-  -Icontrib/jsoncpp/include \
-  -std=c++17  \
-  -s WASM=1 \
-  -s USE_WEBGL2=1 \
-  -s MIN_WEBGL_VERSION=2 \
-  -s MAX_WEBGL_VERSION=2 \
-  -O2 \
-  -o gen/index.js
+#
+# Builds two modules: gen/index.js is single-threaded and runs everywhere,
+# gen/index_threaded.js uses pthreads (SharedArrayBuffer) and is only picked by
+# index.html when the page is cross-origin isolated. Stops at the first failed
+# build, so that a stale gen/index_threaded.js is not left next to a new
+# gen/index.js.
+set -e
+
+SOURCES=(
+  src/cc/viz.cc
+  src/cc/renderer.cc
+  contrib/abseil-cpp/absl/strings/numbers.cc
+  contrib/abseil-cpp/absl/strings/str_cat.cc
+)
+FLAGS=(
+  -Icontrib/googletest/googletest/include
+  -Icontrib/eigen
+  -Icontrib/abseil-cpp
+  -std=c++17
+  -s WASM=1
+  -s USE_WEBGL2=1
+  -s MIN_WEBGL_VERSION=2
+  -s MAX_WEBGL_VERSION=2
+  -s "EXPORTED_RUNTIME_METHODS=['ccall']"
+  -O2
+)
+
+emcc "${SOURCES[@]}" "${FLAGS[@]}" -o gen/index.js
+
+emcc "${SOURCES[@]}" "${FLAGS[@]}" \
+  -pthread \
+  -s PTHREAD_POOL_SIZE=navigator.hardwareConcurrency \
+  -o gen/index_threaded.js
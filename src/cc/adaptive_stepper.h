@@ -0,0 +1,78 @@
+#pragma once
+#include "common.h"
+#include "simulation.h"
+#include "subject.h"
+#include <algorithm>
+#include <cmath>
+
+// Distance by which a susceptible and a contagious subject can close in on
+// each other within |ticks| ticks, except with probability 1e-3. Subjects
+// move an exponentially distributed distance per tick, so the distance both
+// walk together is gamma distributed; this is its 99.9th percentile, by the
+// Wilson-Hilferty approximation.
+inline double GetClosingDistanceBound(const SimulationConfig& config,
+                                      Tick ticks) {
+  const double mean_per_tick =
+      2.5 * config.subject_velocity_units_per_second * kSecondsPerTick;
+  const double shape = 2.0 * ticks;
+  constexpr double kNormalQuantile = 3.09;
+  const double root = 1.0 - 1.0 / (9.0 * shape) +
+                      kNormalQuantile * std::sqrt(1.0 / (9.0 * shape));
+  return mean_per_tick * shape * root * root * root;
+}
+
+// Advances a Simulation in steps of varying length up to a fixed horizon.
+// Steps are |base_dt| while some susceptible subject is exposed. Otherwise
+// they grow up to |max_dt|, but never past the next infection state
+// transition, and never so far that a susceptible subject could move into
+// range of a contagious one. Steps only grow while the epidemic is active
+// if no susceptible subject is left in the grid's active tiles, which keeps
+// them a tile away; within a cell of each other, they cannot close the gap
+// any faster than one tick. Once no subject is infected any more, the
+// epidemic is over and the stepper fast-forwards to the horizon.
+class AdaptiveStepper {
+public:
+  AdaptiveStepper(Tick base_dt, Tick max_dt, Tick horizon)
+      : base_dt_(base_dt), max_dt_(max_dt), horizon_(horizon) {
+    assert(base_dt_ <= max_dt_);
+  }
+
+  // Advances |simulation| by one step and returns its length, which is zero
+  // once the horizon has been reached.
+  Tick Step(Simulation* simulation) const {
+    const Tick elapsed = simulation->GetElapsedSimulationTime();
+    if (elapsed >= horizon_)
+      return 0;
+    const Tick remaining = horizon_ - elapsed;
+
+    const Simulation::Activity activity = simulation->ComputeActivity();
+    if (!activity.any_infected) {
+      simulation->FastForward(remaining);
+      return remaining;
+    }
+    const Tick dt = std::min(
+        ChooseTimeStep(activity, simulation->GetConfig()), remaining);
+    simulation->Update(dt);
+    return dt;
+  }
+
+  Tick ChooseTimeStep(const Simulation::Activity& activity,
+                      const SimulationConfig& config) const {
+    if (activity.any_exposed)
+      return base_dt_;
+    Tick dt = std::min(max_dt_, activity.time_to_next_transition);
+    if (activity.any_susceptible) {
+      const double gap =
+          activity.susceptible_distance - config.distance_to_infect;
+      while (dt > base_dt_ && GetClosingDistanceBound(config, dt) >= gap) {
+        --dt;
+      }
+    }
+    return std::max(dt, base_dt_);
+  }
+
+private:
+  Tick base_dt_;
+  Tick max_dt_;
+  Tick horizon_;
+};
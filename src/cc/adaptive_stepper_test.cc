@@ -0,0 +1,83 @@
+#include "adaptive_stepper.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr Tick kHorizon = 365 * kTicksPerDay;
+
+void InitWithSusceptibleSubjects(int subject_count, Simulation* simulation) {
+  simulation->InitEmpty(subject_count);
+  for (int i = 0; i < subject_count; ++i) {
+    simulation->AddSubject(Subject(Eigen::Vector2d(0.5, 0.5)));
+  }
+}
+
+}  // namespace
+
+TEST(AdaptiveStepperTest, FastForwardsAfterExtinction) {
+  Simulation simulation;
+  InitWithSusceptibleSubjects(100, &simulation);
+  const AdaptiveStepper stepper(1, kTicksPerDay, kHorizon);
+  EXPECT_EQ(stepper.Step(&simulation), kHorizon);
+  EXPECT_EQ(simulation.GetElapsedSimulationTime(), kHorizon);
+  EXPECT_EQ(stepper.Step(&simulation), 0u);
+}
+
+TEST(AdaptiveStepperTest, UsesBaseStepWhileExposed) {
+  Simulation simulation;
+  InitWithSusceptibleSubjects(100, &simulation);
+  simulation.Infect(0);
+  const AdaptiveStepper stepper(1, kTicksPerDay, kHorizon);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(stepper.Step(&simulation), 1u);
+  }
+}
+
+TEST(AdaptiveStepperTest, GrowsStepWithoutSusceptibleSubjects) {
+  Simulation simulation;
+  simulation.InitEmpty(2);
+  Subject recovered(Eigen::Vector2d(0.5, 0.5));
+  recovered.SetRecovered();
+  simulation.AddSubject(recovered);
+  simulation.AddSubject(Subject(Eigen::Vector2d(0.5, 0.5)));
+  simulation.Infect(1);
+  const AdaptiveStepper stepper(1, kTicksPerDay, kHorizon);
+
+  // Turns contagious in the first step, symptoms start after 14 days.
+  EXPECT_EQ(stepper.Step(&simulation), 1u);
+  Tick elapsed = 1;
+  while (elapsed < kTicksToSymptoms) {
+    const Tick dt = stepper.Step(&simulation);
+    EXPECT_EQ(dt, std::min(kTicksPerDay, kTicksToSymptoms - elapsed));
+    elapsed += dt;
+  }
+  // Weekly reorders may have swapped the two subjects.
+  const SubjectIndex index = simulation.GetSubjectId(0) == 1 ? 0 : 1;
+  EXPECT_EQ(simulation.GetSubjects()[index].GetInfectionState(),
+            InfectionState::kInfectedWithSymptoms);
+}
+
+TEST(AdaptiveStepperTest, GrowsStepWhileSusceptibleSubjectsAreFar) {
+  // A contagious subject in one corner and everyone else in a crowd a few
+  // tiles away.
+  Simulation simulation;
+  simulation.InitEmpty(5000);
+  simulation.AddSubject(Subject(Eigen::Vector2d(0.1, 0.1)));
+  simulation.Infect(0);
+  for (int i = 1; i < 5000; ++i) {
+    simulation.AddSubject(Subject(Eigen::Vector2d(0.6, 0.6)));
+  }
+  const AdaptiveStepper stepper(1, 12, kHorizon);
+
+  // Turns contagious in the first step.
+  EXPECT_EQ(stepper.Step(&simulation), 1u);
+  for (int i = 0; i < 10; ++i) {
+    const Simulation::Activity activity = simulation.ComputeActivity();
+    ASSERT_TRUE(activity.any_susceptible);
+    ASSERT_FALSE(activity.any_exposed);
+    EXPECT_GT(stepper.Step(&simulation), 6u);
+  }
+  const InfectionStateHistogram histogram =
+      simulation.ComputeInfectionStateHistogram();
+  EXPECT_EQ(histogram[static_cast<int>(InfectionState::kUninfected)], 4999);
+}
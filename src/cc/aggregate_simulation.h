@@ -0,0 +1,237 @@
+#pragma once
+
+#include "cell_grid.h"
+#include "common.h"
+#include "simulation.h"
+#include "subject.h"
+#include "worker_pool.h"
+#include <array>
+#include <cmath>
+#include <vector>
+
+// Contacts per hour that a subject has in the agent-based Simulation's demo
+// scenario (kDefaultSubjectCount subjects in the unit square): the expected
+// number of other subjects within kDistanceToInfect.
+constexpr double kDefaultAggregateContactsPerHour =
+    kDefaultSubjectCount * M_PI * kDistanceToInfect * kDistanceToInfect;
+
+// Stochastic compartment model for populations far beyond what the
+// agent-based Simulation can hold. The patches are the tiles of the cell grid
+// that Simulation builds for such populations, with cells as large as the
+// infection distance, like HybridSimulation's tiles. Each patch stores counts
+// per InfectionState instead of individual subjects and is advanced by
+// tau-leaping: every Update draws the number of new infections per patch from
+// a binomial distribution, using the force of infection at the start of the
+// step.
+//
+// Infected subjects are kept in cohorts by infection time, so the timing
+// parameters of |config| apply exactly as they do to individual subjects.
+// Transmission uses its pairwise probability; contacts are mixed within a
+// patch and, for the share of contacts that cross a patch edge, with the four
+// adjacent patches.
+//
+// Offers the same reporting interface as Simulation.
+class AggregateSimulation {
+public:
+  explicit AggregateSimulation(
+      double contacts_per_hour = kDefaultAggregateContactsPerHour,
+      const SimulationConfig& config = SimulationConfig())
+      : patch_grid_(config.distance_to_infect),
+        contact_hazard_per_hour_(
+            -std::log1p(-config.GetPairInfectionProbability()) *
+            contacts_per_hour),
+        ticks_to_symptoms_(config.GetTicksToSymptoms()),
+        ticks_to_recovery_(config.GetTicksToRecovery()) {
+    assert(config.IsValid());
+    // Share of contacts within the infection distance of a uniformly placed
+    // subject that lie across one of the patch's four edges. Only the tiles
+    // in the last row and column can be smaller.
+    Eigen::Vector2d min_corner, max_corner;
+    patch_grid_.GetTileBounds(0, &min_corner, &max_corner);
+    const double patch_size = max_corner[0] - min_corner[0];
+    edge_coupling_ = std::min(
+        1.0, 8.0 * config.distance_to_infect / (3.0 * M_PI * patch_size));
+
+    // Edge neighbors from the 3x3 tile neighborhood, which lists the tiles
+    // row by row.
+    adjacent_patches_.resize(patch_grid_.GetTileCount());
+    std::vector<int> tile_ids;
+    for (int i = 0; i < adjacent_patches_.size(); ++i) {
+      patch_grid_.GetTileNeighborhood(i, &tile_ids);
+      adjacent_patches_[i] = {tile_ids[1], tile_ids[3], tile_ids[5],
+                              tile_ids[7]};
+    }
+  }
+
+  void Init(int64_t population) {
+    start_time_ = time_;
+    const int num_patches = patch_grid_.GetTileCount();
+    patches_.assign(num_patches, Patch());
+    contagious_fractions_.resize(num_patches);
+
+    // Spread the population over the patches in proportion to their area.
+    int64_t remaining_population = population;
+    double remaining_area = 1.0;
+    for (int i = 0; i < num_patches; ++i) {
+      Eigen::Vector2d min_corner, max_corner;
+      patch_grid_.GetTileBounds(i, &min_corner, &max_corner);
+      const double area = (max_corner - min_corner).prod();
+      std::binomial_distribution<int64_t> patch_population(
+          remaining_population, std::min(area / remaining_area, 1.0));
+      patches_[i].susceptible = patch_population(GetRandomEngine());
+      remaining_population -= patches_[i].susceptible;
+      remaining_area -= area;
+    }
+    patches_.back().susceptible += remaining_population;
+
+    // Like Simulation, start by infecting one random subject.
+    if (population == 0)
+      return;
+    std::uniform_int_distribution<int64_t> seed_distribution(0,
+                                                             population - 1);
+    int64_t seed = seed_distribution(GetRandomEngine());
+    int seed_patch = 0;
+    while (seed >= patches_[seed_patch].susceptible) {
+      seed -= patches_[seed_patch++].susceptible;
+    }
+    Infect(&patches_[seed_patch], 1);
+  }
+
+  int GetPatchCount() const { return patches_.size(); }
+
+  void Update(Tick dt) {
+    time_ += dt;
+    const int num_patches = patches_.size();
+
+    // Advance cohorts through their fixed-duration states.
+    worker_pool_.ParallelFor(num_patches, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        AdvanceCohorts(&patches_[i]);
+        contagious_fractions_[i] = patches_[i].ContagiousFraction();
+      }
+    });
+
+    // Draw new infections from the force of infection at the start of the
+    // step.
+    const double dt_hours = dt * kSecondsPerTick / 3600.0;
+    worker_pool_.ParallelFor(num_patches, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        Patch* patch = &patches_[i];
+        if (patch->susceptible == 0)
+          continue;
+        const double contagious_fraction = MixedContagiousFraction(i);
+        if (contagious_fraction == 0.0)
+          continue;
+        const double infection_probability = -std::expm1(
+            -contact_hazard_per_hour_ * contagious_fraction * dt_hours);
+        std::binomial_distribution<int64_t> new_infections(
+            patch->susceptible, infection_probability);
+        Infect(patch, new_infections(GetRandomEngine()));
+      }
+    });
+  }
+
+  InfectionStateHistogram ComputeInfectionStateHistogram() const {
+    InfectionStateHistogram infection_state_counts = {};
+    for (const Patch& patch : patches_) {
+      infection_state_counts[static_cast<int>(InfectionState::kUninfected)] +=
+          patch.susceptible;
+      infection_state_counts[static_cast<int>(
+          InfectionState::kInfectedWithoutSymptoms)] += patch.presymptomatic;
+      infection_state_counts[static_cast<int>(
+          InfectionState::kInfectedWithSymptoms)] += patch.symptomatic;
+      infection_state_counts[static_cast<int>(InfectionState::kRecovered)] +=
+          patch.recovered;
+    }
+    return infection_state_counts;
+  }
+
+  Tick GetElapsedSimulationTime() const { return time_ - start_time_; }
+
+private:
+  // Subjects that were infected at the same time.
+  struct Cohort {
+    Tick infection_time;
+    int64_t count;
+  };
+
+  // Cohorts only exist for the steps in which a patch saw infections, which
+  // near the frontier is every step and elsewhere none. They are therefore
+  // kept in a queue that grows with the live cohorts, rather than in a ring
+  // buffer indexed by tick, which every patch would need for the whole
+  // infectious period. Both stages share the queue, ordered by infection
+  // time: cohorts [first_cohort, first_presymptomatic_cohort) have symptoms.
+  // Consumed cohorts are dropped once they make up half of the vector, so
+  // steady state does not allocate.
+  struct Patch {
+    double ContagiousFraction() const {
+      const int64_t contagious = presymptomatic + symptomatic;
+      const int64_t total = susceptible + contagious + recovered;
+      return total > 0 ? static_cast<double>(contagious) / total : 0.0;
+    }
+
+    int64_t susceptible = 0;
+    int64_t presymptomatic = 0;
+    int64_t symptomatic = 0;
+    int64_t recovered = 0;
+    std::vector<Cohort> cohorts;
+    size_t first_cohort = 0;
+    size_t first_presymptomatic_cohort = 0;
+  };
+
+  void Infect(Patch* patch, int64_t count) {
+    if (count == 0)
+      return;
+    patch->susceptible -= count;
+    patch->presymptomatic += count;
+    patch->cohorts.push_back(Cohort{time_, count});
+  }
+
+  // Same transition times as Subject::MaybeInfect.
+  void AdvanceCohorts(Patch* patch) const {
+    std::vector<Cohort>& cohorts = patch->cohorts;
+    while (patch->first_presymptomatic_cohort < cohorts.size() &&
+           cohorts[patch->first_presymptomatic_cohort].infection_time +
+                   ticks_to_symptoms_ <=
+               time_) {
+      const int64_t count =
+          cohorts[patch->first_presymptomatic_cohort++].count;
+      patch->presymptomatic -= count;
+      patch->symptomatic += count;
+    }
+    while (patch->first_cohort < patch->first_presymptomatic_cohort &&
+           cohorts[patch->first_cohort].infection_time + ticks_to_recovery_ <=
+               time_) {
+      const int64_t count = cohorts[patch->first_cohort++].count;
+      patch->symptomatic -= count;
+      patch->recovered += count;
+    }
+    if (patch->first_cohort > 0 && 2 * patch->first_cohort >= cohorts.size()) {
+      cohorts.erase(cohorts.begin(), cohorts.begin() + patch->first_cohort);
+      patch->first_presymptomatic_cohort -= patch->first_cohort;
+      patch->first_cohort = 0;
+    }
+  }
+
+  // Contagious fraction seen by the contacts of a subject in |patch_id|.
+  double MixedContagiousFraction(int patch_id) const {
+    double adjacent_sum = 0.0;
+    for (const int adjacent_patch_id : adjacent_patches_[patch_id]) {
+      adjacent_sum += contagious_fractions_[adjacent_patch_id];
+    }
+    return (1.0 - edge_coupling_) * contagious_fractions_[patch_id] +
+           edge_coupling_ * 0.25 * adjacent_sum;
+  }
+
+  CellGrid<int> patch_grid_;
+  double contact_hazard_per_hour_;
+  Tick ticks_to_symptoms_;
+  Tick ticks_to_recovery_;
+  double edge_coupling_;
+  std::vector<std::array<int, 4>> adjacent_patches_;
+  std::vector<Patch> patches_;
+  std::vector<double> contagious_fractions_;
+  WorkerPool worker_pool_;
+  Tick start_time_ = 0;
+  Tick time_ = 0;
+};
@@ -0,0 +1,94 @@
+#include "aggregate_simulation.h"
+#include "gtest/gtest.h"
+#include <chrono>
+#include <numeric>
+
+namespace {
+
+int64_t Total(const InfectionStateHistogram& histogram) {
+  return std::accumulate(histogram.begin(), histogram.end(), int64_t{0});
+}
+
+int64_t Count(const InfectionStateHistogram& histogram, InfectionState state) {
+  return histogram[static_cast<int>(state)];
+}
+
+}  // namespace
+
+TEST(AggregateSimulationTest, PatchesAreCellGridTiles) {
+  SimulationConfig config;
+  AggregateSimulation simulation(kDefaultAggregateContactsPerHour, config);
+  simulation.Init(1000);
+  EXPECT_EQ(simulation.GetPatchCount(),
+            CellGrid<int>(config.distance_to_infect).GetTileCount());
+}
+
+TEST(AggregateSimulationTest, ConservesPopulation) {
+  constexpr int64_t kPopulation = 10000000;
+  AggregateSimulation simulation;
+  simulation.Init(kPopulation);
+  EXPECT_EQ(Total(simulation.ComputeInfectionStateHistogram()), kPopulation);
+
+  int64_t previous_ever_infected = 0;
+  for (int step = 0; step < 400; ++step) {
+    // Steps of varying length.
+    simulation.Update(1 + step % 5);
+    const InfectionStateHistogram histogram =
+        simulation.ComputeInfectionStateHistogram();
+    ASSERT_EQ(Total(histogram), kPopulation) << "at step " << step;
+    const int64_t ever_infected =
+        kPopulation - Count(histogram, InfectionState::kUninfected);
+    ASSERT_GE(ever_infected, previous_ever_infected) << "at step " << step;
+    previous_ever_infected = ever_infected;
+  }
+  EXPECT_GT(previous_ever_infected, 1);
+}
+
+TEST(AggregateSimulationTest, CohortsFollowConfiguredTimes) {
+  SimulationConfig config;
+  config.days_to_symptoms = 2;
+  config.days_symptoms_to_recovery = 3;
+  for (const Tick dt : {1, 5}) {
+    // Without contacts, the seed infection is the only one.
+    AggregateSimulation simulation(/*contacts_per_hour=*/0.0, config);
+    simulation.Init(1000);
+    Tick symptoms_time = 0;
+    Tick recovery_time = 0;
+    while (recovery_time == 0) {
+      simulation.Update(dt);
+      const InfectionStateHistogram histogram =
+          simulation.ComputeInfectionStateHistogram();
+      ASSERT_EQ(Count(histogram, InfectionState::kUninfected), 999);
+      if (symptoms_time == 0 &&
+          Count(histogram, InfectionState::kInfectedWithSymptoms) == 1) {
+        symptoms_time = simulation.GetElapsedSimulationTime();
+      }
+      if (Count(histogram, InfectionState::kRecovered) == 1)
+        recovery_time = simulation.GetElapsedSimulationTime();
+    }
+    // Transitions happen in the first step that reaches them.
+    const auto round_up = [dt](Tick ticks) {
+      return (ticks + dt - 1) / dt * dt;
+    };
+    EXPECT_EQ(symptoms_time, round_up(config.GetTicksToSymptoms())) << dt;
+    EXPECT_EQ(recovery_time, round_up(config.GetTicksToRecovery())) << dt;
+  }
+}
+
+TEST(AggregateSimulationTest, RunsAYearOfANationInSeconds) {
+  constexpr int64_t kPopulation = 300000000;
+  AggregateSimulation simulation;
+  simulation.Init(kPopulation);
+  const auto start = std::chrono::steady_clock::now();
+  for (Tick tick = 0; tick < 365 * kTicksPerDay; ++tick) {
+    simulation.Update(1);
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  EXPECT_LT(seconds, 10.0);
+  EXPECT_EQ(Total(simulation.ComputeInfectionStateHistogram()), kPopulation);
+  EXPECT_GT(Count(simulation.ComputeInfectionStateHistogram(),
+                  InfectionState::kRecovered),
+            kPopulation / 2);
+}
@@ -0,0 +1,68 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+// Samples indices in proportion to non-negative weights in O(1) per sample
+// (Vose's alias method). Every index owns an equal slice of [0, 1); a
+// uniform number picks the slice, and its position within the slice decides
+// between the index itself and the index's alias, which absorbed the excess
+// weight of heavier indices when the table was built. Immutable once built,
+// so it can be shared by all threads.
+class AliasTable {
+public:
+  explicit AliasTable(const std::vector<double>& weights) {
+    const int n = weights.size();
+    assert(n > 0);
+    double total = 0.0;
+    for (const double weight : weights) {
+      assert(weight >= 0.0);
+      total += weight;
+    }
+    assert(total > 0.0);
+
+    // Scale weights so that they average 1, then pair every slice that is
+    // short of 1 with one that exceeds it.
+    probabilities_.resize(n);
+    aliases_.resize(n);
+    std::vector<int32_t> small;
+    std::vector<int32_t> large;
+    for (int i = 0; i < n; ++i) {
+      probabilities_[i] = weights[i] * n / total;
+      aliases_[i] = i;
+      (probabilities_[i] < 1.0 ? small : large).push_back(i);
+    }
+    while (!small.empty() && !large.empty()) {
+      const int32_t short_index = small.back();
+      small.pop_back();
+      const int32_t long_index = large.back();
+      aliases_[short_index] = long_index;
+      probabilities_[long_index] -= 1.0 - probabilities_[short_index];
+      if (probabilities_[long_index] < 1.0) {
+        large.pop_back();
+        small.push_back(long_index);
+      }
+    }
+    // Whatever is left is 1 up to rounding.
+    for (const int32_t i : small) {
+      probabilities_[i] = 1.0;
+    }
+    for (const int32_t i : large) {
+      probabilities_[i] = 1.0;
+    }
+  }
+
+  int size() const { return probabilities_.size(); }
+
+  // Maps |u|, uniform in [0, 1), to an index.
+  int Sample(double u) const {
+    const double scaled = u * probabilities_.size();
+    const int slice = std::min<int>(scaled, probabilities_.size() - 1);
+    return scaled - slice < probabilities_[slice] ? slice : aliases_[slice];
+  }
+
+private:
+  std::vector<double> probabilities_;
+  std::vector<int32_t> aliases_;
+};
@@ -0,0 +1,24 @@
+#include "alias_table.h"
+#include "gtest/gtest.h"
+
+TEST(AliasTableTest, SamplesInProportionToWeights) {
+  const std::vector<double> weights = {1.0, 0.0, 3.0, 0.5, 5.5};
+  const AliasTable table(weights);
+  // Sweeping [0, 1) evenly hits every index exactly as often as the table
+  // would sample it.
+  constexpr int kNumSamples = 1000000;
+  std::vector<int> counts(weights.size());
+  for (int i = 0; i < kNumSamples; ++i) {
+    ++counts[table.Sample((i + 0.5) / kNumSamples)];
+  }
+  EXPECT_EQ(counts[1], 0);
+  for (int i = 0; i < weights.size(); ++i) {
+    EXPECT_NEAR(counts[i], weights[i] / 10.0 * kNumSamples, 10) << i;
+  }
+}
+
+TEST(AliasTableTest, SingleWeight) {
+  const AliasTable table({2.0});
+  EXPECT_EQ(table.Sample(0.0), 0);
+  EXPECT_EQ(table.Sample(0.999), 0);
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include <cstdint>
+
+// Debug counter of heap allocations, for checking that hot paths do not
+// allocate. Linking allocation_counter.cc replaces the global operator new to
+// count every call, so only test binaries should link it.
+int64_t GetAllocationCount();
@@ -0,0 +1,118 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Bump allocator for short-lived scratch memory, e.g. the neighbor lists that
+// each chunk of a parallel phase gathers. Every thread has its own arena, so
+// scratch allocations never contend, and memory is released in bulk when a
+// Scope closes. Once the arena has grown to the peak demand of a tick, later
+// ticks reuse its blocks without touching the heap.
+class ScratchArena {
+public:
+  static ScratchArena& ForThisThread() {
+    thread_local ScratchArena arena;
+    return arena;
+  }
+
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+
+  void* Allocate(size_t bytes, size_t alignment) {
+    while (true) {
+      if (block_ < blocks_.size()) {
+        Block& block = blocks_[block_];
+        const uintptr_t base = reinterpret_cast<uintptr_t>(block.data.get());
+        const size_t offset =
+            (base + offset_ + alignment - 1) / alignment * alignment - base;
+        if (offset + bytes <= block.size) {
+          offset_ = offset + bytes;
+          return block.data.get() + offset;
+        }
+        if (block_ + 1 < blocks_.size()) {
+          ++block_;
+          offset_ = 0;
+          continue;
+        }
+      }
+      // Out of blocks; grow the arena.
+      const size_t size = std::max(kBlockSize, bytes + alignment);
+      blocks_.push_back(Block{std::make_unique<char[]>(size), size});
+      block_ = blocks_.size() - 1;
+      offset_ = 0;
+    }
+  }
+
+  // Everything allocated from |arena| while a Scope is open is released when
+  // it closes.
+  class Scope {
+  public:
+    explicit Scope(ScratchArena* arena = &ForThisThread())
+        : arena_(arena), block_(arena->block_), offset_(arena->offset_) {}
+    ~Scope() {
+      arena_->block_ = block_;
+      arena_->offset_ = offset_;
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    ScratchArena* arena_;
+    size_t block_;
+    size_t offset_;
+  };
+
+private:
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  ScratchArena() = default;
+
+  std::vector<Block> blocks_;
+  size_t block_ = 0;
+  size_t offset_ = 0;
+};
+
+// Allocator that takes memory from the calling thread's ScratchArena.
+// Deallocation is a no-op; the memory comes back when the enclosing
+// ScratchArena::Scope closes, which must outlive the container.
+template <typename T>
+class ScratchAllocator {
+public:
+  using value_type = T;
+
+  ScratchAllocator() : arena_(&ScratchArena::ForThisThread()) {}
+  template <typename U>
+  ScratchAllocator(const ScratchAllocator<U>& other) : arena_(other.arena_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T*, size_t) {}
+
+  template <typename U>
+  bool operator==(const ScratchAllocator<U>& other) const {
+    return arena_ == other.arena_;
+  }
+  template <typename U>
+  bool operator!=(const ScratchAllocator<U>& other) const {
+    return arena_ != other.arena_;
+  }
+
+private:
+  template <typename U>
+  friend class ScratchAllocator;
+
+  ScratchArena* arena_;
+};
+
+template <typename T>
+using ScratchVector = std::vector<T, ScratchAllocator<T>>;
@@ -1,38 +1,287 @@
+#pragma once
 #include "gtest/gtest_prod.h"
 #include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
 #include <iostream>
-#include <set>
+#include <limits>
+#include <type_traits>
 #include <vector>
 
-template <typename T>
+// Uniform grid over the unit square that bins integer indices (e.g. into a
+// subject array) by position. The index type determines the per-entry cost,
+// so populations below 65536 can use uint16_t.
+//
+// Each cell is an unordered array of entries, and the grid remembers the cell
+// and slot of every entry, so removal is a swap with the cell's last entry and
+// Move() costs nothing while an entry stays within its cell. Indices should be
+// dense, since the back-references are an array indexed by them.
+template <typename Index>
 class CellGrid {
+  static_assert(std::is_integral<Index>::value,
+                "CellGrid stores indices, not pointers or objects.");
+
 public:
+  using Cell = std::vector<Index>;
+
   explicit CellGrid(double cell_size) {
     cell_size_ = cell_size;
     resolution_ = std::ceil(1.0 / cell_size_);
     cells_.resize(resolution_ * resolution_);
+    // Locations store cell ids as Index, with its maximum meaning "not in
+    // the grid".
+    assert(cells_.size() <= std::numeric_limits<Index>::max());
+    marks_.resize(cells_.size());
+    neighborhood_marks_.resize(cells_.size());
+
+    tile_resolution_ = (resolution_ + kTileSize - 1) / kTileSize;
+    tile_neighborhood_marks_.resize(tile_resolution_ * tile_resolution_);
+    active_tile_slots_.resize(tile_neighborhood_marks_.size(), -1);
+    active_tiles_.reserve(tile_neighborhood_marks_.size());
   }
 
-  void Add(T t, const Eigen::Vector2d& position) {
-    //std::cout << "adding" << t << " at " << position.transpose() << std::endl;
-    const int cell_id = CellIdFromPosition(position);
-    const auto result = cells_[cell_id].insert(t);
-    assert(result.second);
+  // Pre-sizes the grid for |expected_entry_count| uniformly spread entries,
+  // with enough headroom per cell that random fluctuations rarely make a cell
+  // grow later.
+  void Reserve(int expected_entry_count) {
+    const double mean =
+        static_cast<double>(expected_entry_count) / cells_.size();
+    const int capacity = std::ceil(mean + 6.0 * std::sqrt(mean) + 6.0);
+    for (auto& cell : cells_) {
+      cell.reserve(capacity);
+    }
+    locations_.reserve(expected_entry_count);
   }
 
-  void Remove(T t, const Eigen::Vector2d& position) {
-    //std::cout << "removing " << t << " at " << position.transpose() << std::endl;
+  void Add(Index index, const Eigen::Vector2d& position) {
+    AddToCell(index, CellIdFromPosition(position));
+  }
+
+  // |position| is where |index| was added; only checked in debug builds.
+  void Remove(Index index, const Eigen::Vector2d& position) {
+    assert(GetCellIdOf(index) == CellIdFromPosition(position));
+    RemoveFromCell(index);
+  }
+
+  // Replaces all entries with the indices [0, |count|), binned by
+  // position_of(index), in one counting-sort pass: cells are sized for their
+  // exact entry count before they are filled. Marks are cleared.
+  template <typename PositionFn>
+  void BulkLoad(Index count, const PositionFn& position_of) {
+    Clear();
+    locations_.resize(count);
+    cell_counts_.assign(cells_.size(), 0);
+    for (Index index = 0; index < count; ++index) {
+      const int cell_id = CellIdFromPosition(position_of(index));
+      locations_[index].cell_id = static_cast<Index>(cell_id);
+      ++cell_counts_[cell_id];
+    }
+    for (int cell_id = 0; cell_id < cells_.size(); ++cell_id) {
+      cells_[cell_id].reserve(cell_counts_[cell_id]);
+    }
+    for (Index index = 0; index < count; ++index) {
+      Cell& cell = cells_[locations_[index].cell_id];
+      locations_[index].slot = cell.size();
+      cell.push_back(index);
+    }
+  }
+
+  // Re-bins |index| at |position|. Returns whether it changed cells.
+  bool Move(Index index, const Eigen::Vector2d& position) {
     const int cell_id = CellIdFromPosition(position);
-    const int num_elements_removed = cells_[cell_id].erase(t);
-    assert(num_elements_removed == 1);
+    if (cell_id == GetCellIdOf(index))
+      return false;
+    RemoveFromCell(index);
+    AddToCell(index, cell_id);
+    return true;
+  }
+
+  // Cell that |index| was added to.
+  int GetCellIdOf(Index index) const {
+    assert(index < locations_.size() &&
+           locations_[index].cell_id != kNotInGrid);
+    return locations_[index].cell_id;
+  }
+
+  void Clear() {
+    for (auto& cell : cells_) {
+      for (const Index index : cell) {
+        locations_[index].cell_id = kNotInGrid;
+      }
+      cell.clear();
+    }
+    std::fill(marks_.begin(), marks_.end(), 0);
+    std::fill(neighborhood_marks_.begin(), neighborhood_marks_.end(), 0);
+    std::fill(tile_neighborhood_marks_.begin(), tile_neighborhood_marks_.end(),
+              0);
+    std::fill(active_tile_slots_.begin(), active_tile_slots_.end(), -1);
+    active_tiles_.clear();
+  }
+
+  // Marks are a per-cell count kept next to the entries, e.g. of contagious
+  // subjects. The grid also tracks the count over each cell's 3x3
+  // neighborhood, so callers can skip cells that have no marked entry nearby
+  // in O(1).
+  void AddMark(const Eigen::Vector2d& position) {
+    UpdateMarks(CellIdFromPosition(position), 1);
+  }
+
+  void RemoveMark(const Eigen::Vector2d& position) {
+    UpdateMarks(CellIdFromPosition(position), -1);
+  }
+
+  void AddMarkToCell(int cell_id) { UpdateMarks(cell_id, 1); }
+  void RemoveMarkFromCell(int cell_id) { UpdateMarks(cell_id, -1); }
+
+  int GetMarkCount(int cell_id) const { return marks_[cell_id]; }
+
+  bool IsNeighborhoodMarked(int cell_id) const {
+    return neighborhood_marks_[cell_id] > 0;
+  }
+
+  int GetCellCount() const { return cells_.size(); }
+
+  // Cells per row and per column. Cell ids count row by row from the origin,
+  // i.e. the cell in column x and row y has id y * resolution + x.
+  int GetResolution() const { return resolution_; }
+
+  double GetCellSize() const { return cell_size_; }
+
+  // Tiles are kTileSize x kTileSize blocks of cells. A tile is active while it
+  // or one of its eight neighbors contains a mark, so the active tiles cover
+  // every cell for which IsNeighborhoodMarked() holds. The set grows and
+  // shrinks with AddMark/RemoveMark, in no particular order.
+  const std::vector<int>& GetActiveTiles() const { return active_tiles_; }
+
+  int GetTileCount() const { return tile_neighborhood_marks_.size(); }
+
+  // Narrowest extent of a cell or a tile. The last row and column of cells,
+  // and of tiles, are cut off by the domain boundary.
+  double GetMinCellExtent() const {
+    return std::min(cell_size_, 1.0 - (resolution_ - 1) * cell_size_);
+  }
+  double GetMinTileExtent() const {
+    const double tile_extent = kTileSize * cell_size_;
+    return std::min(tile_extent, 1.0 - (tile_resolution_ - 1) * tile_extent);
+  }
+
+  int TileIdFromPosition(const Eigen::Vector2d& position) const {
+    return TileIdFromTileCoordinate(CellCoordinateFromPosition(position) /
+                                    kTileSize);
+  }
+
+  // Returns |tile_id| and its eight neighbors, wrapping around the domain.
+  template <typename Allocator>
+  void GetTileNeighborhood(int tile_id,
+                           std::vector<int, Allocator>* tile_ids) const {
+    tile_ids->clear();
+    const Eigen::Vector2i tile_coordinate(tile_id % tile_resolution_,
+                                          tile_id / tile_resolution_);
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        tile_ids->push_back(TileIdFromTileCoordinate(
+            AdjacentTileCoordinate(tile_coordinate, Eigen::Vector2i(dx, dy))));
+      }
+    }
+  }
+
+  // Corners of the area covered by |tile_id|, clipped to the unit square.
+  void GetTileBounds(int tile_id, Eigen::Vector2d* min_corner,
+                     Eigen::Vector2d* max_corner) const {
+    const double tile_extent = kTileSize * cell_size_;
+    const Eigen::Vector2d tile_coordinate(tile_id % tile_resolution_,
+                                          tile_id / tile_resolution_);
+    *min_corner = tile_coordinate * tile_extent;
+    *max_corner = (*min_corner + Eigen::Vector2d::Constant(tile_extent))
+                      .cwiseMin(Eigen::Vector2d::Ones());
   }
 
-  void GetNeighbors(const Eigen::Vector2d& position, std::vector<T>* neighbors) {
+  template <typename Allocator>
+  void GetCellsOfTile(int tile_id,
+                      std::vector<int, Allocator>* cell_ids) const {
+    cell_ids->clear();
+    const int tile_x = tile_id % tile_resolution_;
+    const int tile_y = tile_id / tile_resolution_;
+    const int x_end = std::min((tile_x + 1) * kTileSize, resolution_);
+    const int y_end = std::min((tile_y + 1) * kTileSize, resolution_);
+    for (int y = tile_y * kTileSize; y < y_end; ++y) {
+      for (int x = tile_x * kTileSize; x < x_end; ++x) {
+        cell_ids->push_back(CellIdFromCellCoordinate(Eigen::Vector2i(x, y)));
+      }
+    }
+  }
+
+  // Returns the cells of |tile_id| and the |margin| rings of cells around it,
+  // wrapping around the domain; each cell is returned once.
+  template <typename Allocator>
+  void GetCellsAroundTile(int tile_id, int margin,
+                          std::vector<int, Allocator>* cell_ids) const {
+    cell_ids->clear();
+    int begin[2];
+    int end[2];
+    const int tile_coordinate[2] = {tile_id % tile_resolution_,
+                                    tile_id / tile_resolution_};
+    for (int i = 0; i < 2; ++i) {
+      begin[i] = tile_coordinate[i] * kTileSize - margin;
+      end[i] = std::min((tile_coordinate[i] + 1) * kTileSize, resolution_) +
+               margin;
+      if (end[i] - begin[i] >= resolution_) {
+        begin[i] = 0;
+        end[i] = resolution_;
+      }
+    }
+    for (int y = begin[1]; y < end[1]; ++y) {
+      for (int x = begin[0]; x < end[0]; ++x) {
+        cell_ids->push_back(CellIdFromCellCoordinate(
+            Eigen::Vector2i((x + resolution_) % resolution_,
+                            (y + resolution_) % resolution_)));
+      }
+    }
+  }
+
+  const Cell& GetCell(int cell_id) const { return cells_[cell_id]; }
+
+  // Returns the cells that overlap the rectangle from |min_corner| to
+  // |max_corner|. Corners may lie outside the unit square, in which case the
+  // rectangle wraps around the domain; each cell is returned once.
+  template <typename Allocator>
+  void GetCellsInRect(const Eigen::Vector2d& min_corner,
+                      const Eigen::Vector2d& max_corner,
+                      std::vector<int, Allocator>* cell_ids) const {
+    cell_ids->clear();
+    int x_ranges[4];
+    int y_ranges[4];
+    const int num_x_ranges =
+        CellRangesOfInterval(min_corner[0], max_corner[0], x_ranges);
+    const int num_y_ranges =
+        CellRangesOfInterval(min_corner[1], max_corner[1], y_ranges);
+    for (int j = 0; j < num_y_ranges; ++j) {
+      for (int y = y_ranges[2 * j]; y <= y_ranges[2 * j + 1]; ++y) {
+        for (int i = 0; i < num_x_ranges; ++i) {
+          for (int x = x_ranges[2 * i]; x <= x_ranges[2 * i + 1]; ++x) {
+            cell_ids->push_back(
+                CellIdFromCellCoordinate(Eigen::Vector2i(x, y)));
+          }
+        }
+      }
+    }
+  }
+
+  template <typename Allocator>
+  void GetNeighbors(const Eigen::Vector2d& position,
+                    std::vector<Index, Allocator>* neighbors) const {
+    GetNeighborsOfCell(CellIdFromPosition(position), neighbors);
+  }
+
+  // Returns the entries of |cell_id| and its eight neighbors.
+  template <typename Allocator>
+  void GetNeighborsOfCell(int cell_id,
+                          std::vector<Index, Allocator>* neighbors) const {
     neighbors->clear();
 
     using Eigen::Vector2i;
 
-    const Vector2i cell_coordinate = CellCoordinateFromPosition(position);
+    const Vector2i cell_coordinate = CellCoordinateFromCellId(cell_id);
 
     // Left column.
     AddCellContentsToVector(
@@ -59,7 +308,125 @@ public:
   }
 
 private:
-  void AddCellContentsToVector(const Eigen::Vector2i& cell_coordinate, std::vector<T>* result) {
+  static constexpr Index kNotInGrid = std::numeric_limits<Index>::max();
+
+  // Where an entry is stored; cell_id is kNotInGrid while the entry is not in
+  // the grid. Both fields are Index wide, as there are no more cells than
+  // indices and no more slots in a cell than entries: 4 bytes per entry for
+  // uint16_t, 8 for uint32_t.
+  struct Location {
+    Index cell_id = kNotInGrid;
+    Index slot = 0;
+  };
+
+  void AddToCell(Index index, int cell_id) {
+    if (index >= locations_.size())
+      locations_.resize(static_cast<size_t>(index) + 1);
+    assert(locations_[index].cell_id == kNotInGrid);
+    Cell& cell = cells_[cell_id];
+    locations_[index] = Location{static_cast<Index>(cell_id),
+                                 static_cast<Index>(cell.size())};
+    cell.push_back(index);
+  }
+
+  void RemoveFromCell(Index index) {
+    Location& location = locations_[index];
+    Cell& cell = cells_[location.cell_id];
+    const Index last = cell.back();
+    cell[location.slot] = last;
+    locations_[last].slot = location.slot;
+    cell.pop_back();
+    location.cell_id = kNotInGrid;
+  }
+
+  void UpdateMarks(int cell_id, int delta) {
+    marks_[cell_id] += delta;
+    assert(marks_[cell_id] >= 0);
+    const Eigen::Vector2i cell_coordinate = CellCoordinateFromCellId(cell_id);
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        const Eigen::Vector2i neighbor =
+            AdjacentCellCoordinate(cell_coordinate, Eigen::Vector2i(dx, dy));
+        neighborhood_marks_[CellIdFromCellCoordinate(neighbor)] += delta;
+      }
+    }
+
+    const Eigen::Vector2i tile_coordinate = cell_coordinate / kTileSize;
+    for (int dy = -1; dy <= 1; ++dy) {
+      for (int dx = -1; dx <= 1; ++dx) {
+        const int tile_id = TileIdFromTileCoordinate(
+            AdjacentTileCoordinate(tile_coordinate, Eigen::Vector2i(dx, dy)));
+        const int old_count = tile_neighborhood_marks_[tile_id];
+        const int new_count = old_count + delta;
+        tile_neighborhood_marks_[tile_id] = new_count;
+        if (old_count == 0 && new_count > 0)
+          ActivateTile(tile_id);
+        else if (old_count > 0 && new_count == 0)
+          DeactivateTile(tile_id);
+      }
+    }
+  }
+
+  void ActivateTile(int tile_id) {
+    active_tile_slots_[tile_id] = active_tiles_.size();
+    active_tiles_.push_back(tile_id);
+  }
+
+  void DeactivateTile(int tile_id) {
+    const int slot = active_tile_slots_[tile_id];
+    active_tiles_[slot] = active_tiles_.back();
+    active_tile_slots_[active_tiles_[slot]] = slot;
+    active_tiles_.pop_back();
+    active_tile_slots_[tile_id] = -1;
+  }
+
+  // Writes the inclusive ranges of cell coordinates that the wrapped interval
+  // [min, max] covers into |ranges| as (first, last) pairs and returns their
+  // number, at most two.
+  int CellRangesOfInterval(double min, double max, int* ranges) const {
+    if (max - min >= 1.0) {
+      ranges[0] = 0;
+      ranges[1] = resolution_ - 1;
+      return 1;
+    }
+    const double begin = min - std::floor(min);
+    const double end = begin + (max - min);
+    const auto cell_of = [this](double coordinate) {
+      return std::min(static_cast<int>(coordinate / cell_size_),
+                      resolution_ - 1);
+    };
+    ranges[0] = cell_of(begin);
+    if (end < 1.0) {
+      ranges[1] = cell_of(end);
+      return 1;
+    }
+    ranges[1] = resolution_ - 1;
+    if (ranges[0] == 0)
+      return 1;
+    ranges[2] = 0;
+    ranges[3] = std::min(cell_of(end - 1.0), ranges[0] - 1);
+    return 2;
+  }
+
+  Eigen::Vector2i AdjacentTileCoordinate(const Eigen::Vector2i &coordinate,
+                                         const Eigen::Vector2i &offset) const {
+    Eigen::Vector2i result = coordinate + offset;
+    for (int i = 0; i < 2; ++i) {
+      if (result[i] < 0)
+        result[i] += tile_resolution_;
+      if (result[i] >= tile_resolution_)
+        result[i] -= tile_resolution_;
+    }
+    return result;
+  }
+
+  int TileIdFromTileCoordinate(const Eigen::Vector2i& coordinate) const {
+    return coordinate[1] * tile_resolution_ + coordinate[0];
+  }
+
+  template <typename Allocator>
+  void AddCellContentsToVector(const Eigen::Vector2i& cell_coordinate,
+                               std::vector<Index, Allocator>* result) const {
     const int cell_id = CellIdFromCellCoordinate(cell_coordinate);
     const auto& cell = cells_[cell_id];
     for (const auto& entry : cell) {
@@ -68,7 +435,7 @@ private:
   }
 
   Eigen::Vector2i AdjacentCellCoordinate(const Eigen::Vector2i &coordinate,
-                                         const Eigen::Vector2i &offset) {
+                                         const Eigen::Vector2i &offset) const {
     Eigen::Vector2i result = coordinate + offset;
     if (result[0] < 0)
       result[0] += resolution_;
@@ -80,22 +447,38 @@ private:
       result[1] -= resolution_;
     return result;
   }
-  Eigen::Vector2i CellCoordinateFromPosition(const Eigen::Vector2d& position) {
+  Eigen::Vector2i CellCoordinateFromPosition(
+      const Eigen::Vector2d& position) const {
     return Eigen::Vector2i(std::floor(position[0] / cell_size_),
                            std::floor(position[1] / cell_size_));
   }
 
-  int CellIdFromCellCoordinate(const Eigen::Vector2i& coordinate) {
+  int CellIdFromCellCoordinate(const Eigen::Vector2i& coordinate) const {
     return coordinate[1] * resolution_ + coordinate[0];
   }
 
-  int CellIdFromPosition(const Eigen::Vector2d& position) {
+  Eigen::Vector2i CellCoordinateFromCellId(int cell_id) const {
+    return Eigen::Vector2i(cell_id % resolution_, cell_id / resolution_);
+  }
+
+  int CellIdFromPosition(const Eigen::Vector2d& position) const {
     return CellIdFromCellCoordinate(CellCoordinateFromPosition(position));
   }
 
   FRIEND_TEST(CellGridTest, CellIdFromPosition);
+  FRIEND_TEST(CellGridTest, BulkLoadMatchesRepeatedAdd);
+
+  static constexpr int kTileSize = 8;
 
-  std::vector<std::set<T>> cells_;
+  std::vector<Cell> cells_;
+  std::vector<Location> locations_;
+  std::vector<int> cell_counts_;
+  std::vector<int> marks_;
+  std::vector<int> neighborhood_marks_;
+  std::vector<int> tile_neighborhood_marks_;
+  std::vector<int> active_tile_slots_;
+  std::vector<int> active_tiles_;
   double cell_size_;
   int resolution_;
+  int tile_resolution_;
 };
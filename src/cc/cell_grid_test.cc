@@ -1,5 +1,7 @@
 #include "cell_grid.h"
 #include "gtest/gtest.h"
+#include <random>
+#include <set>
 
 using Eigen::Vector2d;
 
@@ -30,6 +32,24 @@ TEST(CellGridTest, AddRemove) {
   EXPECT_EQ(neighbors.size(), 0);
 }
 
+TEST(CellGridTest, NarrowIndex) {
+  CellGrid<uint16_t> cg(0.1);
+  cg.Add(65535, Vector2d(0.45, 0.47));
+  cg.Add(0, Vector2d(0.55, 0.47));
+
+  std::vector<uint16_t> neighbors;
+  cg.GetNeighbors(Vector2d(0.46, 0.46), &neighbors);
+  ASSERT_EQ(neighbors.size(), 2);
+  EXPECT_NE(std::find(neighbors.begin(), neighbors.end(), 65535),
+            neighbors.end());
+
+  EXPECT_TRUE(cg.Move(65535, Vector2d(0.95, 0.95)));
+  EXPECT_EQ(cg.GetCellIdOf(65535), 99);
+  cg.Remove(0, Vector2d(0.55, 0.47));
+  cg.GetNeighbors(Vector2d(0.46, 0.46), &neighbors);
+  EXPECT_EQ(neighbors.size(), 0);
+}
+
 TEST(CellGridTest, GetNeighbors) {
   CellGrid<int> cg(0.1);
   // Add cells as follows:
@@ -77,3 +97,158 @@ TEST(CellGridTest, GetNeighbors) {
   EXPECT_NE(std::find(neighbors.begin(), neighbors.end(), 13), neighbors.end());
   EXPECT_EQ(std::find(neighbors.begin(), neighbors.end(), 14), neighbors.end());
 }
+
+TEST(CellGridTest, Marks) {
+  CellGrid<int> cg(0.1);
+  const Vector2d position(0.45, 0.45);
+  const int cell_id = 4 * 10 + 4;
+  cg.AddMark(position);
+  cg.AddMark(position);
+  EXPECT_EQ(cg.GetMarkCount(cell_id), 2);
+  EXPECT_TRUE(cg.IsNeighborhoodMarked(cell_id));
+  EXPECT_TRUE(cg.IsNeighborhoodMarked(3 * 10 + 5));
+  EXPECT_FALSE(cg.IsNeighborhoodMarked(4 * 10 + 6));
+
+  // Neighborhoods wrap around the domain boundary.
+  cg.AddMark(Vector2d(0.05, 0.05));
+  EXPECT_TRUE(cg.IsNeighborhoodMarked(9 * 10 + 9));
+
+  cg.RemoveMark(position);
+  EXPECT_TRUE(cg.IsNeighborhoodMarked(cell_id));
+  cg.RemoveMark(position);
+  EXPECT_EQ(cg.GetMarkCount(cell_id), 0);
+  EXPECT_FALSE(cg.IsNeighborhoodMarked(cell_id));
+}
+
+TEST(CellGridTest, ActiveTiles) {
+  // 40x40 cells, i.e. 5x5 tiles of 8x8 cells.
+  CellGrid<int> cg(0.025);
+  ASSERT_EQ(cg.GetTileCount(), 25);
+  EXPECT_TRUE(cg.GetActiveTiles().empty());
+
+  // A mark in tile (2, 2) activates it and its eight neighbors.
+  const Vector2d position(0.5, 0.5);
+  cg.AddMark(position);
+  cg.AddMark(position);
+  std::vector<int> active_tiles = cg.GetActiveTiles();
+  std::sort(active_tiles.begin(), active_tiles.end());
+  EXPECT_EQ(active_tiles,
+            std::vector<int>({6, 7, 8, 11, 12, 13, 16, 17, 18}));
+
+  // A mark in the corner tile wraps around the domain boundary.
+  cg.AddMark(Vector2d(0.01, 0.01));
+  EXPECT_EQ(cg.GetActiveTiles().size(), 9 + 8);
+
+  cg.RemoveMark(position);
+  EXPECT_EQ(cg.GetActiveTiles().size(), 9 + 8);
+  cg.RemoveMark(position);
+  active_tiles = cg.GetActiveTiles();
+  std::sort(active_tiles.begin(), active_tiles.end());
+  EXPECT_EQ(active_tiles,
+            std::vector<int>({0, 1, 4, 5, 6, 9, 20, 21, 24}));
+
+  std::vector<int> cell_ids;
+  cg.GetCellsOfTile(24, &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 64);
+  EXPECT_EQ(cell_ids.back(), 40 * 40 - 1);
+}
+
+TEST(CellGridTest, Move) {
+  CellGrid<int> cg(0.1);
+  cg.Add(0, Vector2d(0.41, 0.41));
+  cg.Add(1, Vector2d(0.42, 0.42));
+  cg.Add(2, Vector2d(0.43, 0.43));
+  const int cell_id = cg.GetCellIdOf(0);
+
+  EXPECT_FALSE(cg.Move(0, Vector2d(0.49, 0.49)));
+  EXPECT_EQ(cg.GetCellIdOf(0), cell_id);
+
+  EXPECT_TRUE(cg.Move(0, Vector2d(0.75, 0.75)));
+  EXPECT_NE(cg.GetCellIdOf(0), cell_id);
+  EXPECT_EQ(cg.GetCell(cell_id).size(), 2);
+
+  // The entry that took the removed entry's slot can still be removed.
+  cg.Remove(2, Vector2d(0.43, 0.43));
+  cg.Remove(1, Vector2d(0.42, 0.42));
+  EXPECT_TRUE(cg.GetCell(cell_id).empty());
+  EXPECT_EQ(cg.GetCell(cg.GetCellIdOf(0)).size(), 1);
+}
+
+TEST(CellGridTest, BulkLoadMatchesRepeatedAdd) {
+  std::mt19937 rng(3);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::vector<Vector2d> positions;
+  for (int i = 0; i < 5000; ++i) {
+    positions.emplace_back(uniform(rng), uniform(rng));
+  }
+  CellGrid<int> added(0.025);
+  for (int i = 0; i < positions.size(); ++i) {
+    added.Add(i, positions[i]);
+  }
+  CellGrid<int> loaded(0.025);
+  // Leftovers from an earlier load are cleared.
+  loaded.Add(0, Vector2d(0.5, 0.5));
+  loaded.AddMark(Vector2d(0.5, 0.5));
+  loaded.BulkLoad(positions.size(),
+                  [&](int index) { return positions[index]; });
+  for (int i = 0; i < positions.size(); i += 500) {
+    added.AddMarkToCell(added.GetCellIdOf(i));
+    loaded.AddMarkToCell(loaded.GetCellIdOf(i));
+  }
+
+  for (int cell_id = 0; cell_id < added.GetCellCount(); ++cell_id) {
+    const std::set<int> expected(added.GetCell(cell_id).begin(),
+                                 added.GetCell(cell_id).end());
+    const std::set<int> actual(loaded.GetCell(cell_id).begin(),
+                               loaded.GetCell(cell_id).end());
+    EXPECT_EQ(actual, expected) << "cell " << cell_id;
+    EXPECT_EQ(loaded.GetCell(cell_id).size(), added.GetCell(cell_id).size());
+  }
+  for (int i = 0; i < positions.size(); ++i) {
+    const int cell_id = loaded.GetCellIdOf(i);
+    EXPECT_EQ(cell_id, added.GetCellIdOf(i));
+    EXPECT_EQ(loaded.GetCell(cell_id)[loaded.locations_[i].slot], i);
+  }
+  std::vector<int> expected_tiles = added.GetActiveTiles();
+  std::vector<int> actual_tiles = loaded.GetActiveTiles();
+  std::sort(expected_tiles.begin(), expected_tiles.end());
+  std::sort(actual_tiles.begin(), actual_tiles.end());
+  EXPECT_EQ(actual_tiles, expected_tiles);
+}
+
+TEST(CellGridTest, GetCellsInRect) {
+  CellGrid<int> cg(0.25);
+  std::vector<int> cell_ids;
+  cg.GetCellsInRect(Vector2d(0.3, 0.3), Vector2d(0.6, 0.4), &cell_ids);
+  EXPECT_EQ(cell_ids, std::vector<int>({5, 6}));
+
+  // Wraps around both edges.
+  cg.GetCellsInRect(Vector2d(-0.1, 0.9), Vector2d(0.1, 1.05), &cell_ids);
+  EXPECT_EQ(cell_ids, std::vector<int>({15, 12, 3, 0}));
+
+  cg.GetCellsInRect(Vector2d(0.0, 0.0), Vector2d(1.0, 1.0), &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 16);
+}
+
+TEST(CellGridTest, GetCellsAroundTile) {
+  // 20x20 cells, i.e. 3x3 tiles with a partial last row and column.
+  CellGrid<int> cg(0.05);
+  std::vector<int> cell_ids;
+  cg.GetCellsAroundTile(4, 0, &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 64);
+
+  // The corner tile wraps around to the last cells of the domain.
+  cg.GetCellsAroundTile(0, 1, &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 10 * 10);
+  EXPECT_EQ(cell_ids.front(), 20 * 20 - 1);
+  EXPECT_EQ(std::set<int>(cell_ids.begin(), cell_ids.end()).size(), 100);
+
+  // The partial tile in the last column has 4x8 cells.
+  cg.GetCellsAroundTile(5, 2, &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 8 * 12);
+
+  // Margins beyond the domain return each cell once.
+  cg.GetCellsAroundTile(4, 7, &cell_ids);
+  EXPECT_EQ(cell_ids.size(), 20 * 20);
+  EXPECT_EQ(std::set<int>(cell_ids.begin(), cell_ids.end()).size(), 400);
+}
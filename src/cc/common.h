@@ -1,25 +1,44 @@
 #pragma once
-#include <chrono>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <ostream>
 #include <random>
 
-using Time = std::chrono::steady_clock::time_point;
-using Duration = Time::duration;
-using Hours = std::chrono::hours;
+// Simulation time is counted in ticks of one hour since the start of the
+// simulation; 32 bits last for almost half a million years. The same type
+// holds points in time and durations. Only reporting converts to wall-clock
+// units.
+using Tick = uint32_t;
+constexpr Tick kTicksPerDay = 24;
+constexpr double kSecondsPerTick = 3600.0;
+
+// Position of a subject in the simulation's subject array.
+using SubjectIndex = uint32_t;
+
+// Each thread owns its engine so that the parallel phases of
+// Simulation::Update can draw random numbers without synchronization.
+inline std::default_random_engine &GetRandomEngine() {
+  thread_local std::default_random_engine engine(std::random_device{}());
+  return engine;
+}
 
 inline double GenerateNormalizedUniformRandomNumber() {
-  static std::random_device r;
-  static std::default_random_engine e1(r());
-  static std::uniform_real_distribution<double> uniform_dist(0.0, 1.0);
-  return uniform_dist(e1);
+  std::uniform_real_distribution<double> uniform_dist(0.0, 1.0);
+  return uniform_dist(GetRandomEngine());
 }
 
 inline double GenerateExponentiallyDistributedRandomNumber(double lambda) {
-  static std::default_random_engine generator;
   std::exponential_distribution<double> distribution(lambda);
-  return distribution(generator);
+  return distribution(GetRandomEngine());
 }
 
-enum class InfectionState {
+inline double GenerateStandardNormalRandomNumber() {
+  std::normal_distribution<double> distribution(0.0, 1.0);
+  return distribution(GetRandomEngine());
+}
+
+enum class InfectionState : uint8_t {
   kUninfected,
   kInfectedWithoutSymptoms,
   kInfectedWithSymptoms,
@@ -30,22 +49,31 @@ enum class InfectionState {
 
 constexpr int kNumInfectionStates = static_cast<int>(InfectionState::Count);
 
-inline std::ostream &operator<<(std::ostream &os,
-                                const InfectionState &infection_state) {
+inline bool IsContagious(InfectionState infection_state) {
+  return infection_state == InfectionState::kInfectedWithoutSymptoms ||
+         infection_state == InfectionState::kInfectedWithSymptoms;
+}
+
+// Number of subjects per InfectionState.
+using InfectionStateHistogram = std::array<int64_t, kNumInfectionStates>;
+
+inline const char *InfectionStateName(InfectionState infection_state) {
   switch (infection_state) {
   case InfectionState::kUninfected:
-    os << "Uninfected";
-    return os;
+    return "Uninfected";
   case InfectionState::kInfectedWithoutSymptoms:
-    os << "InfectedWithoutSymptoms";
-    return os;
+    return "InfectedWithoutSymptoms";
   case InfectionState::kInfectedWithSymptoms:
-    os << "InfectedWithSymptoms";
-    return os;
+    return "InfectedWithSymptoms";
   case InfectionState::kRecovered:
-    os << "Recovered";
-    return os;
+    return "Recovered";
   default:
     assert(false);
+    return "";
   }
 }
+
+inline std::ostream &operator<<(std::ostream &os,
+                                const InfectionState &infection_state) {
+  return os << InfectionStateName(infection_state);
+}
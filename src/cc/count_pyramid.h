@@ -0,0 +1,102 @@
+#pragma once
+#include "cell_grid.h"
+#include "common.h"
+#include "subject_store.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+// Quadtree of counts per InfectionState over the cells of a CellGrid, for
+// maps that zoom from the whole domain down to single cells. Level 0 is one
+// node for the whole domain, and every level splits each node of the level
+// above into 2x2. The finest level has a node per cell, padded to a power of
+// two; nodes in the padding stay empty.
+//
+// Counts are kept up to date with Add(), which the simulation calls for
+// every subject that changes cells or state. That touches one node per
+// level, so a pan or zoom never has to go back to the subjects.
+class CountPyramid {
+public:
+  // Sets up an empty pyramid for a grid with |resolution| x |resolution|
+  // cells of |cell_size|.
+  CountPyramid(int resolution, double cell_size)
+      : resolution_(resolution), cell_size_(cell_size) {
+    int level_resolution = 1;
+    while (true) {
+      levels_.emplace_back(static_cast<size_t>(level_resolution) *
+                           level_resolution);
+      if (level_resolution >= resolution)
+        break;
+      level_resolution *= 2;
+    }
+  }
+
+  // Recounts all subjects binned in |grid|, which must have the pyramid's
+  // resolution.
+  void Build(const CellGrid<SubjectIndex>& grid, const SubjectStore& subjects) {
+    assert(grid.GetResolution() == resolution_);
+    for (auto& level : levels_) {
+      std::fill(level.begin(), level.end(), InfectionStateHistogram{});
+    }
+    for (int cell_id = 0; cell_id < grid.GetCellCount(); ++cell_id) {
+      for (const SubjectIndex index : grid.GetCell(cell_id)) {
+        Add(cell_id, subjects[index].GetInfectionState(), 1);
+      }
+    }
+  }
+
+  // Adds |delta| subjects in |infection_state| to cell |cell_id| of the grid.
+  void Add(int cell_id, InfectionState infection_state, int delta) {
+    int x = cell_id % resolution_;
+    int y = cell_id / resolution_;
+    const int state = static_cast<int>(infection_state);
+    for (int level = levels_.size() - 1; level >= 0; --level) {
+      levels_[level][(y << level) + x][state] += delta;
+      x /= 2;
+      y /= 2;
+    }
+  }
+
+  int GetLevelCount() const { return levels_.size(); }
+
+  // Nodes per row and column at |level|.
+  int GetLevelResolution(int level) const { return 1 << level; }
+
+  const InfectionStateHistogram& GetNode(int level, int x, int y) const {
+    return levels_[level][(y << level) + x];
+  }
+
+  // Area that node (x, y) of |level| covers, clipped to the unit square. It is
+  // empty for nodes in the padding.
+  void GetNodeBounds(int level, int x, int y, Eigen::Vector2d* min_corner,
+                     Eigen::Vector2d* max_corner) const {
+    const double node_size =
+        cell_size_ * (1 << (levels_.size() - 1 - level));
+    *min_corner = (Eigen::Vector2d(x, y) * node_size).cwiseMin(1.0);
+    *max_corner = (Eigen::Vector2d(x + 1, y + 1) * node_size).cwiseMin(1.0);
+  }
+
+  // Returns the descendants of node (x, y) of |level| that are |depth|
+  // levels further down, as a row-major 2^depth x 2^depth tile. |depth| is
+  // clipped to the finest level.
+  void GetTile(int level, int x, int y, int depth,
+               std::vector<InfectionStateHistogram>* tile) const {
+    depth = std::min<int>(depth, levels_.size() - 1 - level);
+    const int tile_resolution = 1 << depth;
+    const int child_level = level + depth;
+    tile->resize(static_cast<size_t>(tile_resolution) * tile_resolution);
+    for (int dy = 0; dy < tile_resolution; ++dy) {
+      for (int dx = 0; dx < tile_resolution; ++dx) {
+        (*tile)[dy * tile_resolution + dx] =
+            GetNode(child_level, (x << depth) + dx, (y << depth) + dy);
+      }
+    }
+  }
+
+private:
+  int resolution_;
+  double cell_size_;
+  // Nodes of each level, row by row.
+  std::vector<std::vector<InfectionStateHistogram>> levels_;
+};
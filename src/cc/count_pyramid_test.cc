@@ -0,0 +1,61 @@
+#include "count_pyramid.h"
+#include "gtest/gtest.h"
+
+using Eigen::Vector2d;
+
+TEST(CountPyramidTest, NodesSumTheirChildren) {
+  // Four cells per row and column; the last ones reach past the unit square.
+  CellGrid<SubjectIndex> grid(0.3);
+  SubjectStore subjects;
+  for (int i = 0; i < 500; ++i) {
+    subjects.emplace_back(Vector2d(GenerateNormalizedUniformRandomNumber(),
+                                   GenerateNormalizedUniformRandomNumber()));
+    if (i % 4 == 0)
+      subjects.back().SetRecovered();
+  }
+  grid.BulkLoad(subjects.size(), [&](SubjectIndex index) {
+    return subjects[index].GetPosition();
+  });
+  CountPyramid pyramid(grid.GetResolution(), grid.GetCellSize());
+  pyramid.Build(grid, subjects);
+
+  ASSERT_EQ(pyramid.GetLevelCount(), 3);
+  const InfectionStateHistogram& root = pyramid.GetNode(0, 0, 0);
+  EXPECT_EQ(root[static_cast<int>(InfectionState::kUninfected)], 375);
+  EXPECT_EQ(root[static_cast<int>(InfectionState::kRecovered)], 125);
+
+  for (int level = 0; level + 1 < pyramid.GetLevelCount(); ++level) {
+    const int level_resolution = pyramid.GetLevelResolution(level);
+    for (int y = 0; y < level_resolution; ++y) {
+      for (int x = 0; x < level_resolution; ++x) {
+        std::vector<InfectionStateHistogram> tile;
+        pyramid.GetTile(level, x, y, 1, &tile);
+        ASSERT_EQ(tile.size(), 4);
+        InfectionStateHistogram sum = {};
+        for (const InfectionStateHistogram& child : tile) {
+          for (int state = 0; state < kNumInfectionStates; ++state) {
+            sum[state] += child[state];
+          }
+        }
+        EXPECT_EQ(sum, pyramid.GetNode(level, x, y));
+      }
+    }
+  }
+
+  pyramid.Add(grid.GetCellIdOf(0), InfectionState::kRecovered, -1);
+  pyramid.Add(grid.GetCellIdOf(0), InfectionState::kInfectedWithSymptoms, 1);
+  EXPECT_EQ(root[static_cast<int>(InfectionState::kRecovered)], 124);
+  EXPECT_EQ(root[static_cast<int>(InfectionState::kInfectedWithSymptoms)], 1);
+}
+
+TEST(CountPyramidTest, NodeBoundsAreClippedToUnitSquare) {
+  // Three cells per row and column, padded to four.
+  CountPyramid pyramid(3, 0.4);
+  Vector2d min_corner;
+  Vector2d max_corner;
+  pyramid.GetNodeBounds(1, 1, 0, &min_corner, &max_corner);
+  EXPECT_EQ(min_corner, Vector2d(0.8, 0.0));
+  EXPECT_EQ(max_corner, Vector2d(1.0, 0.8));
+  pyramid.GetNodeBounds(2, 3, 3, &min_corner, &max_corner);
+  EXPECT_EQ(min_corner, max_corner);
+}
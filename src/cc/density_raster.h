@@ -0,0 +1,64 @@
+#pragma once
+#include "alias_table.h"
+#include <Eigen/Core>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+// Population density over the unit square, given as a |width| x |height|
+// raster of non-negative weights in row-major order. Row 0 covers
+// y in [0, 1 / height) and column 0 covers x in [0, 1 / width). Weights are
+// relative; only their ratios matter.
+class DensityRaster {
+public:
+  DensityRaster(int width, int height, const std::vector<double>& densities)
+      : width_(width), height_(height), cells_(densities) {
+    assert(densities.size() == static_cast<size_t>(width) * height);
+  }
+
+  // Reads a raster from a text file that starts with the width and height,
+  // followed by width * height densities, all separated by whitespace.
+  // Returns nullopt if the file is malformed or all densities are zero.
+  static std::optional<DensityRaster> LoadFromFile(const std::string& path) {
+    std::ifstream file(path);
+    int width = 0;
+    int height = 0;
+    if (!(file >> width >> height) || width <= 0 || height <= 0)
+      return std::nullopt;
+    std::vector<double> densities(static_cast<size_t>(width) * height);
+    double total = 0.0;
+    for (double& density : densities) {
+      if (!(file >> density) || !std::isfinite(density) || density < 0.0)
+        return std::nullopt;
+      total += density;
+    }
+    // Nowhere to place subjects.
+    if (total <= 0.0)
+      return std::nullopt;
+    return DensityRaster(width, height, densities);
+  }
+
+  int GetWidth() const { return width_; }
+  int GetHeight() const { return height_; }
+
+  // Draws a position with probability proportional to the density, uniform
+  // within the chosen raster cell.
+  template <typename Engine>
+  Eigen::Vector2d SamplePosition(Engine* engine) const {
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    const int cell = cells_.Sample(uniform(*engine));
+    const int column = cell % width_;
+    const int row = cell / width_;
+    return Eigen::Vector2d((column + uniform(*engine)) / width_,
+                           (row + uniform(*engine)) / height_);
+  }
+
+private:
+  int width_;
+  int height_;
+  AliasTable cells_;
+};
@@ -0,0 +1,42 @@
+#include "density_raster.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <fstream>
+
+namespace {
+
+std::optional<DensityRaster> LoadFromText(const std::string& text) {
+  const std::string path = testing::TempDir() + "density_raster_test.txt";
+  std::ofstream(path) << text;
+  std::optional<DensityRaster> raster = DensityRaster::LoadFromFile(path);
+  std::remove(path.c_str());
+  return raster;
+}
+
+}  // namespace
+
+TEST(DensityRasterTest, LoadsFromFile) {
+  const std::optional<DensityRaster> raster =
+      LoadFromText("3 2\n0 1 0\n0 0 0\n");
+  ASSERT_TRUE(raster);
+  EXPECT_EQ(raster->GetWidth(), 3);
+  EXPECT_EQ(raster->GetHeight(), 2);
+  // All weight in the middle of the bottom row.
+  std::default_random_engine engine(1);
+  for (int i = 0; i < 100; ++i) {
+    const Eigen::Vector2d position = raster->SamplePosition(&engine);
+    EXPECT_GE(position[0], 1.0 / 3.0);
+    EXPECT_LT(position[0], 2.0 / 3.0);
+    EXPECT_LT(position[1], 0.5);
+  }
+}
+
+TEST(DensityRasterTest, RejectsInvalidFiles) {
+  EXPECT_FALSE(LoadFromText(""));
+  EXPECT_FALSE(LoadFromText("0 2\n"));
+  EXPECT_FALSE(LoadFromText("2 2\n1 1 1\n"));
+  EXPECT_FALSE(LoadFromText("2 1\n1 -1\n"));
+  EXPECT_FALSE(LoadFromText("2 1\n1 nan\n"));
+  // No cell to place subjects in.
+  EXPECT_FALSE(LoadFromText("2 2\n0 0 0 0\n"));
+}
@@ -0,0 +1,172 @@
+#pragma once
+#include "arena.h"
+#include "worker_pool.h"
+#include <Eigen/Core>
+#include <unsupported/Eigen/FFT>
+#include <cmath>
+#include <complex>
+#include <functional>
+#include <vector>
+
+// Infection hazard per tick as a field over the unit torus. Contagious
+// subjects deposit themselves onto a regular grid, the grid is convolved with
+// a distance kernel via FFT, and susceptible subjects read the hazard at
+// their position. Building the field costs O(N + G log G) for N deposits on a
+// G-node grid, independent of local density, and the kernel may reach much
+// further than the cell grid's 3x3 stencil.
+class ForceOfInfectionField {
+public:
+  // Hazard per tick that a contagious subject at distance d exerts on a
+  // susceptible one.
+  using Kernel = std::function<double(double distance)>;
+
+  // Kernel of the pairwise model: a constant hazard up to |radius|, such that
+  // each contagious subject within |radius| infects with |probability| per
+  // tick.
+  static Kernel DiskKernel(double radius, double probability) {
+    const double hazard = -std::log1p(-probability);
+    return [radius, hazard](double distance) {
+      return distance < radius ? hazard : 0.0;
+    };
+  }
+
+  // |resolution| is the number of grid nodes per side and should be a power
+  // of two. The node spacing needs to be well below the kernel's length
+  // scale.
+  ForceOfInfectionField(const Kernel& kernel, int resolution)
+      : resolution_(resolution),
+        deposits_(resolution * resolution),
+        field_(resolution * resolution),
+        buffer_(resolution * resolution) {
+    // Sample the kernel at every node offset, using the shortest distance on
+    // the torus so that the circular convolution wraps like CellGrid.
+    const double spacing = 1.0 / resolution_;
+    for (int y = 0; y < resolution_; ++y) {
+      for (int x = 0; x < resolution_; ++x) {
+        const double dx = std::min(x, resolution_ - x) * spacing;
+        const double dy = std::min(y, resolution_ - y) * spacing;
+        buffer_[y * resolution_ + x] = kernel(std::hypot(dx, dy));
+      }
+    }
+    WorkerPool single_thread(0);
+    Transform2d(/*inverse=*/false, &single_thread);
+    kernel_spectrum_ = buffer_;
+  }
+
+  void Clear() {
+    std::fill(deposits_.begin(), deposits_.end(), 0.0);
+    num_deposits_ = 0;
+  }
+
+  // Deposits one contagious subject, spread bilinearly over the four
+  // surrounding nodes.
+  void Deposit(const Eigen::Vector2d& position) {
+    ForEachSurroundingNode(position, [this](int node, double weight) {
+      deposits_[node] += weight;
+    });
+    ++num_deposits_;
+  }
+
+  // Convolves the deposits with the kernel, spreading the FFTs over
+  // |worker_pool|.
+  void Compute(WorkerPool* worker_pool) {
+    if (num_deposits_ == 0) {
+      std::fill(field_.begin(), field_.end(), 0.0);
+      return;
+    }
+    for (int i = 0; i < deposits_.size(); ++i) {
+      buffer_[i] = deposits_[i];
+    }
+    Transform2d(/*inverse=*/false, worker_pool);
+    for (int i = 0; i < buffer_.size(); ++i) {
+      buffer_[i] *= kernel_spectrum_[i];
+    }
+    Transform2d(/*inverse=*/true, worker_pool);
+    for (int i = 0; i < field_.size(); ++i) {
+      // Clamp round-off noise around zero.
+      field_[i] = std::max(buffer_[i].real(), 0.0);
+    }
+  }
+
+  // Hazard at |position|, bilinearly interpolated.
+  double Sample(const Eigen::Vector2d& position) const {
+    double hazard = 0.0;
+    ForEachSurroundingNode(position, [&](int node, double weight) {
+      hazard += weight * field_[node];
+    });
+    return hazard;
+  }
+
+private:
+  template <typename Fn>
+  void ForEachSurroundingNode(const Eigen::Vector2d& position, Fn fn) const {
+    const double gx = position[0] * resolution_;
+    const double gy = position[1] * resolution_;
+    const int x0 = static_cast<int>(std::floor(gx));
+    const int y0 = static_cast<int>(std::floor(gy));
+    const double fx = gx - x0;
+    const double fy = gy - y0;
+    const auto node = [this](int x, int y) {
+      x = (x % resolution_ + resolution_) % resolution_;
+      y = (y % resolution_ + resolution_) % resolution_;
+      return y * resolution_ + x;
+    };
+    fn(node(x0, y0), (1.0 - fx) * (1.0 - fy));
+    fn(node(x0 + 1, y0), fx * (1.0 - fy));
+    fn(node(x0, y0 + 1), (1.0 - fx) * fy);
+    fn(node(x0 + 1, y0 + 1), fx * fy);
+  }
+
+  // In-place 2D FFT of buffer_, as 1D transforms of all rows and then all
+  // columns. Each thread keeps its own FFT object because their plan caches
+  // are not thread-safe; keeping them across calls also keeps the plans.
+  void Transform2d(bool inverse, WorkerPool* worker_pool) {
+    worker_pool->ParallelFor(resolution_, [&](int begin, int end) {
+      ScratchArena::Scope scratch_scope;
+      Eigen::FFT<double>* fft = GetThreadFft();
+      ScratchVector<std::complex<double>> line(resolution_);
+      for (int y = begin; y < end; ++y) {
+        std::complex<double>* row = &buffer_[y * resolution_];
+        Transform1d(inverse, row, &line, fft);
+        std::copy(line.begin(), line.end(), row);
+      }
+    });
+    worker_pool->ParallelFor(resolution_, [&](int begin, int end) {
+      ScratchArena::Scope scratch_scope;
+      Eigen::FFT<double>* fft = GetThreadFft();
+      ScratchVector<std::complex<double>> column(resolution_);
+      ScratchVector<std::complex<double>> line(resolution_);
+      for (int x = begin; x < end; ++x) {
+        for (int y = 0; y < resolution_; ++y) {
+          column[y] = buffer_[y * resolution_ + x];
+        }
+        Transform1d(inverse, column.data(), &line, fft);
+        for (int y = 0; y < resolution_; ++y) {
+          buffer_[y * resolution_ + x] = line[y];
+        }
+      }
+    });
+  }
+
+  static Eigen::FFT<double>* GetThreadFft() {
+    thread_local Eigen::FFT<double> fft;
+    return &fft;
+  }
+
+  void Transform1d(bool inverse, const std::complex<double>* source,
+                   ScratchVector<std::complex<double>>* destination,
+                   Eigen::FFT<double>* fft) const {
+    if (inverse) {
+      fft->inv(destination->data(), source, resolution_);
+    } else {
+      fft->fwd(destination->data(), source, resolution_);
+    }
+  }
+
+  int resolution_;
+  std::vector<double> deposits_;
+  std::vector<double> field_;
+  std::vector<std::complex<double>> kernel_spectrum_;
+  std::vector<std::complex<double>> buffer_;
+  int num_deposits_ = 0;
+};
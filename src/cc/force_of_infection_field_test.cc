@@ -0,0 +1,45 @@
+#include "force_of_infection_field.h"
+#include "gtest/gtest.h"
+
+using Eigen::Vector2d;
+
+namespace {
+WorkerPool worker_pool(2);
+}  // namespace
+
+TEST(ForceOfInfectionFieldTest, SingleDepositReproducesKernel) {
+  constexpr double kRadius = 0.05;
+  constexpr double kProbability = 0.1;
+  const double hazard = -std::log1p(-kProbability);
+  ForceOfInfectionField field(
+      ForceOfInfectionField::DiskKernel(kRadius, kProbability), 128);
+
+  // A deposit exactly on a node.
+  field.Clear();
+  field.Deposit(Vector2d(0.5, 0.5));
+  field.Compute(&worker_pool);
+  EXPECT_NEAR(field.Sample(Vector2d(0.5, 0.5)), hazard, 1e-9);
+  EXPECT_NEAR(field.Sample(Vector2d(0.5 + 0.5 * kRadius, 0.5)), hazard, 1e-9);
+  EXPECT_NEAR(field.Sample(Vector2d(0.5, 0.5 - 0.5 * kRadius)), hazard, 1e-9);
+  EXPECT_NEAR(field.Sample(Vector2d(0.5 + 2.0 * kRadius, 0.5)), 0.0, 1e-9);
+  EXPECT_NEAR(field.Sample(Vector2d(0.1, 0.9)), 0.0, 1e-9);
+}
+
+TEST(ForceOfInfectionFieldTest, DepositsAddUpAndWrap) {
+  constexpr double kRadius = 0.05;
+  ForceOfInfectionField field(
+      ForceOfInfectionField::DiskKernel(kRadius, 0.5), 64);
+  const double hazard = -std::log1p(-0.5);
+
+  field.Clear();
+  field.Deposit(Vector2d(0.0, 0.0));
+  field.Deposit(Vector2d(0.0, 0.0));
+  field.Compute(&worker_pool);
+  // The kernel reaches across the domain boundary.
+  EXPECT_NEAR(field.Sample(Vector2d(1.0 - 0.5 * kRadius, 0.0)), 2.0 * hazard,
+              1e-9);
+
+  field.Clear();
+  field.Compute(&worker_pool);
+  EXPECT_NEAR(field.Sample(Vector2d(0.0, 0.0)), 0.0, 1e-12);
+}
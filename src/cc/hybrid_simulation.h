@@ -0,0 +1,237 @@
+#pragma once
+
+#include "simulation.h"
+#include <algorithm>
+#include <vector>
+
+// Ticks a tile has to stay away from the epidemic before its subjects are
+// folded back into counts, so that tiles at the edge of the frontier do not
+// flip back and forth.
+constexpr int kTicksBeforeAggregation = 24;
+
+// Agent-based simulation that only resolves individual subjects near the
+// epidemic. The domain is divided into the cell grid's tiles, and a tile far
+// from any contagious subject only holds the number of uninfected and
+// recovered people in it.
+//
+// A tile is needed while it is within two tiles of the grid's active tiles,
+// i.e. within three tiles of a contagious subject. That margin guarantees
+// that a subject infected this tick cannot move and reach an unresolved cell
+// before the next sync. Needed tiles are materialized into Subjects placed
+// uniformly at random. Tiles that have not been needed for
+// kTicksBeforeAggregation ticks are aggregated again. Counts per
+// InfectionState are conserved in both directions.
+//
+// People in aggregated tiles do not move. At uniform density the flows into
+// and out of a tile cancel out. Resolved subjects that wander into an
+// aggregated tile stay resolved until that tile is aggregated.
+//
+// Offers the same reporting interface as Simulation.
+class HybridSimulation {
+public:
+  explicit HybridSimulation(const SimulationConfig& config = SimulationConfig())
+      : simulation_(config) {}
+
+  void Init(int population) {
+    simulation_.InitEmpty(population);
+    const CellGrid<SubjectIndex>& grid = simulation_.GetCellGrid();
+    tiles_.assign(grid.GetTileCount(), Tile());
+
+    // Spread the population over the tiles in proportion to their area.
+    int64_t remaining_population = population;
+    double remaining_area = 1.0;
+    for (int tile_id = 0; tile_id < tiles_.size(); ++tile_id) {
+      Eigen::Vector2d min_corner, max_corner;
+      grid.GetTileBounds(tile_id, &min_corner, &max_corner);
+      const double area = (max_corner - min_corner).prod();
+      std::binomial_distribution<int64_t> tile_population(
+          remaining_population, std::min(area / remaining_area, 1.0));
+      tiles_[tile_id].uninfected = tile_population(GetRandomEngine());
+      remaining_population -= tiles_[tile_id].uninfected;
+      remaining_area -= area;
+    }
+    tiles_.back().uninfected += remaining_population;
+    aggregated_uninfected_ = population;
+
+    // Like Simulation, start with a single infection at a random place. The
+    // seed tile is drawn by population so that it holds someone, and the
+    // subject nearest to a random point in it gets infected.
+    if (population <= 0)
+      return;
+    std::uniform_int_distribution<int64_t> seed_rank_distribution(
+        0, population - 1);
+    int64_t seed_rank = seed_rank_distribution(GetRandomEngine());
+    int seed_tile_id = 0;
+    while (seed_rank >= tiles_[seed_tile_id].uninfected) {
+      seed_rank -= tiles_[seed_tile_id].uninfected;
+      ++seed_tile_id;
+    }
+    Eigen::Vector2d min_corner, max_corner;
+    grid.GetTileBounds(seed_tile_id, &min_corner, &max_corner);
+    const Eigen::Vector2d seed_position =
+        min_corner +
+        Eigen::Vector2d(GenerateNormalizedUniformRandomNumber(),
+                        GenerateNormalizedUniformRandomNumber())
+            .cwiseProduct(max_corner - min_corner);
+    std::vector<int> seed_tiles = {seed_tile_id};
+    DilateTiles(&seed_tiles);
+    DilateTiles(&seed_tiles);
+    for (const int tile_id : seed_tiles) {
+      Materialize(tile_id);
+    }
+    const SubjectStore& subjects = simulation_.GetSubjects();
+    assert(subjects.size() > 0);
+    SubjectIndex seed_index = 0;
+    for (SubjectIndex index = 1; index < subjects.size(); ++index) {
+      if ((subjects[index].GetPosition() - seed_position).squaredNorm() <
+          (subjects[seed_index].GetPosition() - seed_position).squaredNorm())
+        seed_index = index;
+    }
+    simulation_.Infect(seed_index);
+  }
+
+  void Update(Tick dt) {
+    simulation_.Update(dt);
+    Sync();
+  }
+
+  const SubjectStore& GetSubjects() const {
+    return simulation_.GetSubjects();
+  }
+
+  InfectionStateHistogram ComputeInfectionStateHistogram() const {
+    InfectionStateHistogram infection_state_counts =
+        simulation_.ComputeInfectionStateHistogram();
+    infection_state_counts[static_cast<int>(InfectionState::kUninfected)] +=
+        aggregated_uninfected_;
+    infection_state_counts[static_cast<int>(InfectionState::kRecovered)] +=
+        aggregated_recovered_;
+    return infection_state_counts;
+  }
+
+  Tick GetElapsedSimulationTime() const {
+    return simulation_.GetElapsedSimulationTime();
+  }
+
+private:
+  struct Tile {
+    int64_t uninfected = 0;
+    int64_t recovered = 0;
+    int ticks_not_needed = 0;
+    bool needed = false;
+    bool occupied = false;
+  };
+
+  // Materializes tiles the epidemic is approaching and aggregates tiles it
+  // has left behind.
+  void Sync() {
+    const CellGrid<SubjectIndex>& grid = simulation_.GetCellGrid();
+
+    needed_tiles_ = grid.GetActiveTiles();
+    DilateTiles(&needed_tiles_);
+    DilateTiles(&needed_tiles_);
+    for (Tile& tile : tiles_) {
+      tile.needed = false;
+      tile.occupied = false;
+    }
+    for (const int tile_id : needed_tiles_) {
+      tiles_[tile_id].needed = true;
+      tiles_[tile_id].ticks_not_needed = 0;
+      Materialize(tile_id);
+    }
+
+    for (const Subject& subject : simulation_.GetSubjects()) {
+      tiles_[grid.TileIdFromPosition(subject.GetPosition())].occupied = true;
+    }
+    for (int tile_id = 0; tile_id < tiles_.size(); ++tile_id) {
+      Tile& tile = tiles_[tile_id];
+      if (tile.needed || !tile.occupied)
+        continue;
+      if (++tile.ticks_not_needed >= kTicksBeforeAggregation)
+        Aggregate(tile_id);
+    }
+  }
+
+  void Materialize(int tile_id) {
+    Tile& tile = tiles_[tile_id];
+    if (tile.uninfected == 0 && tile.recovered == 0)
+      return;
+    Eigen::Vector2d min_corner, max_corner;
+    simulation_.GetCellGrid().GetTileBounds(tile_id, &min_corner, &max_corner);
+    const auto random_position = [&] {
+      const Eigen::Vector2d t(GenerateNormalizedUniformRandomNumber(),
+                              GenerateNormalizedUniformRandomNumber());
+      return Eigen::Vector2d(
+          min_corner + t.cwiseProduct(max_corner - min_corner));
+    };
+    for (int64_t i = 0; i < tile.uninfected; ++i) {
+      simulation_.AddSubject(Subject(random_position()));
+    }
+    for (int64_t i = 0; i < tile.recovered; ++i) {
+      Subject subject(random_position());
+      subject.SetRecovered();
+      simulation_.AddSubject(subject);
+    }
+    aggregated_uninfected_ -= tile.uninfected;
+    aggregated_recovered_ -= tile.recovered;
+    tile.uninfected = 0;
+    tile.recovered = 0;
+  }
+
+  // Folds the subjects in |tile_id| into counts, unless one of them is
+  // infected.
+  void Aggregate(int tile_id) {
+    const CellGrid<SubjectIndex>& grid = simulation_.GetCellGrid();
+    const SubjectStore& subjects = simulation_.GetSubjects();
+    grid.GetCellsOfTile(tile_id, &cell_ids_);
+    subject_indices_.clear();
+    for (const int cell_id : cell_ids_) {
+      for (const SubjectIndex index : grid.GetCell(cell_id)) {
+        const Subject& subject = subjects[index];
+        if (!subject.IsSusceptible() &&
+            subject.GetInfectionState() != InfectionState::kRecovered) {
+          return;
+        }
+        subject_indices_.push_back(index);
+      }
+    }
+
+    // Removing moves the last subject into the hole, so go from the back to
+    // keep the remaining indices valid.
+    std::sort(subject_indices_.rbegin(), subject_indices_.rend());
+    Tile& tile = tiles_[tile_id];
+    for (const SubjectIndex index : subject_indices_) {
+      if (subjects[index].IsSusceptible()) {
+        ++tile.uninfected;
+        ++aggregated_uninfected_;
+      } else {
+        ++tile.recovered;
+        ++aggregated_recovered_;
+      }
+      simulation_.RemoveSubject(index);
+    }
+    tile.ticks_not_needed = 0;
+  }
+
+  // Adds the neighbors of all |tile_ids| and removes duplicates.
+  void DilateTiles(std::vector<int>* tile_ids) const {
+    const CellGrid<SubjectIndex>& grid = simulation_.GetCellGrid();
+    std::vector<int> dilated;
+    std::vector<int> neighborhood;
+    for (const int tile_id : *tile_ids) {
+      grid.GetTileNeighborhood(tile_id, &neighborhood);
+      dilated.insert(dilated.end(), neighborhood.begin(), neighborhood.end());
+    }
+    std::sort(dilated.begin(), dilated.end());
+    dilated.erase(std::unique(dilated.begin(), dilated.end()), dilated.end());
+    tile_ids->swap(dilated);
+  }
+
+  Simulation simulation_;
+  std::vector<Tile> tiles_;
+  int64_t aggregated_uninfected_ = 0;
+  int64_t aggregated_recovered_ = 0;
+  std::vector<int> needed_tiles_;
+  std::vector<int> cell_ids_;
+  std::vector<SubjectIndex> subject_indices_;
+};
@@ -0,0 +1,48 @@
+#include "hybrid_simulation.h"
+#include "gtest/gtest.h"
+#include <numeric>
+
+namespace {
+
+int64_t Total(const InfectionStateHistogram& histogram) {
+  return std::accumulate(histogram.begin(), histogram.end(), int64_t{0});
+}
+
+}  // namespace
+
+TEST(HybridSimulationTest, ConservesPopulation) {
+  constexpr int kPopulation = 20000;
+  HybridSimulation simulation;
+  simulation.Init(kPopulation);
+  EXPECT_EQ(Total(simulation.ComputeInfectionStateHistogram()), kPopulation);
+  // Only the neighborhood of the seed infection is resolved.
+  EXPECT_LT(simulation.GetSubjects().size(), kPopulation / 10);
+
+  int64_t previous_ever_infected = 0;
+  for (int tick = 0; tick < 24 * 20; ++tick) {
+    simulation.Update(1);
+    const InfectionStateHistogram histogram =
+        simulation.ComputeInfectionStateHistogram();
+    ASSERT_EQ(Total(histogram), kPopulation) << "at tick " << tick;
+    const int64_t ever_infected =
+        kPopulation -
+        histogram[static_cast<int>(InfectionState::kUninfected)];
+    ASSERT_GE(ever_infected, previous_ever_infected) << "at tick " << tick;
+    previous_ever_infected = ever_infected;
+  }
+}
+
+TEST(HybridSimulationTest, SeedsAnInfectionInSparsePopulations) {
+  // With 17 people in a 5x5 grid, the cells around a random point are empty
+  // in about one run out of 600, yet every run must start with an infection.
+  for (int run = 0; run < 20000; ++run) {
+    HybridSimulation simulation;
+    simulation.Init(17);
+    const SubjectStore& subjects = simulation.GetSubjects();
+    int infected_count = 0;
+    for (int i = 0; i < subjects.size(); ++i) {
+      infected_count += !subjects[i].IsSusceptible();
+    }
+    EXPECT_EQ(infected_count, 1) << "in run " << run;
+  }
+}
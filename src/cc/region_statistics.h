@@ -0,0 +1,204 @@
+#pragma once
+#include "cell_grid.h"
+#include "common.h"
+#include "subject_store.h"
+#include "worker_pool.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Block of grid cells: columns [x_begin, x_end) of rows [y_begin, y_end).
+struct CellRect {
+  int x_begin;
+  int y_begin;
+  int x_end;
+  int y_end;
+};
+
+// Counts per InfectionState over regions of the unit square at the
+// resolution of a CellGrid, for dashboards that ask for many regions every
+// tick. Build() takes a snapshot in O(N + cells): it counts every cell's
+// subjects by state and turns the counts into a summed-area table, i.e. the
+// counts of all cells below and left of each grid corner. Any block of cells
+// then costs four lookups, and an arbitrary region costs four lookups per
+// block of its decomposition (see DecomposeRegion).
+//
+// Regions are resolved to whole cells: a cell belongs to a region if its
+// center does. For the last row and column, which can reach past the unit
+// square, that is the center of the part inside it. For counts that are
+// exact to the subject, see Simulation::CountSubjectsInRect.
+class RegionStatistics {
+public:
+  void Build(const CellGrid<SubjectIndex>& grid, const SubjectStore& subjects,
+             WorkerPool* worker_pool) {
+    resolution_ = grid.GetResolution();
+    const double cell_size = grid.GetCellSize();
+    centers_.resize(resolution_);
+    for (int i = 0; i < resolution_; ++i) {
+      centers_[i] = (i * cell_size + std::min((i + 1) * cell_size, 1.0)) / 2.0;
+    }
+
+    // Row 0 and column 0 of the table stay zero. Every other row first
+    // receives the running sums of its own cells, then the rows are summed up.
+    const int stride = resolution_ + 1;
+    sums_.resize(static_cast<size_t>(stride) * stride);
+    std::fill(sums_.begin(), sums_.begin() + stride, InfectionStateHistogram{});
+    worker_pool->ParallelFor(resolution_, [&](int begin, int end) {
+      for (int y = begin; y < end; ++y) {
+        InfectionStateHistogram* row = &sums_[(y + 1) * stride];
+        row[0] = {};
+        for (int x = 0; x < resolution_; ++x) {
+          row[x + 1] = row[x];
+          for (const SubjectIndex index : grid.GetCell(y * resolution_ + x)) {
+            const InfectionState state = subjects[index].GetInfectionState();
+            ++row[x + 1][static_cast<int>(state)];
+          }
+        }
+      }
+    });
+    worker_pool->ParallelFor(stride, [&](int begin, int end) {
+      for (int y = 1; y <= resolution_; ++y) {
+        for (int x = begin; x < end; ++x) {
+          for (int state = 0; state < kNumInfectionStates; ++state) {
+            sums_[y * stride + x][state] += sums_[(y - 1) * stride + x][state];
+          }
+        }
+      }
+    });
+  }
+
+  int GetResolution() const { return resolution_; }
+
+  // Counts of the subjects in |rect|, in O(1).
+  InfectionStateHistogram CountInCells(const CellRect& rect) const {
+    const int stride = resolution_ + 1;
+    const InfectionStateHistogram& top_right =
+        sums_[rect.y_end * stride + rect.x_end];
+    const InfectionStateHistogram& top_left =
+        sums_[rect.y_end * stride + rect.x_begin];
+    const InfectionStateHistogram& bottom_right =
+        sums_[rect.y_begin * stride + rect.x_end];
+    const InfectionStateHistogram& bottom_left =
+        sums_[rect.y_begin * stride + rect.x_begin];
+    InfectionStateHistogram counts;
+    for (int state = 0; state < kNumInfectionStates; ++state) {
+      counts[state] = top_right[state] - top_left[state] -
+                      bottom_right[state] + bottom_left[state];
+    }
+    return counts;
+  }
+
+  // Counts of the subjects in the cells whose centers lie in the rectangle
+  // [min_corner, max_corner). Corners outside the unit square wrap around.
+  InfectionStateHistogram CountInRect(const Eigen::Vector2d& min_corner,
+                                      const Eigen::Vector2d& max_corner) const {
+    int x_ranges[4];
+    int y_ranges[4];
+    const int num_x_ranges =
+        CellRangesOfInterval(min_corner[0], max_corner[0], x_ranges);
+    const int num_y_ranges =
+        CellRangesOfInterval(min_corner[1], max_corner[1], y_ranges);
+    InfectionStateHistogram counts = {};
+    for (int j = 0; j < num_y_ranges; ++j) {
+      for (int i = 0; i < num_x_ranges; ++i) {
+        const InfectionStateHistogram block_counts =
+            CountInCells(CellRect{x_ranges[2 * i], y_ranges[2 * j],
+                                  x_ranges[2 * i + 1], y_ranges[2 * j + 1]});
+        for (int state = 0; state < kNumInfectionStates; ++state) {
+          counts[state] += block_counts[state];
+        }
+      }
+    }
+    return counts;
+  }
+
+  // Decomposes the cells whose centers satisfy contains(center), e.g. a
+  // rasterized district, into blocks for CountInRegion. Each row is split
+  // into runs of contained cells, and runs that repeat the run above extend
+  // its block. Decompose a region once and query it every tick; the blocks
+  // stay valid as long as the grid keeps its resolution.
+  template <typename ContainsFn>
+  std::vector<CellRect> DecomposeRegion(const ContainsFn& contains) const {
+    std::vector<CellRect> rects;
+    // Blocks that end in the previous row, ordered by column.
+    std::vector<int> open_rects;
+    std::vector<int> next_open_rects;
+    for (int y = 0; y < resolution_; ++y) {
+      next_open_rects.clear();
+      int open = 0;
+      for (int x = 0; x < resolution_;) {
+        if (!contains(Eigen::Vector2d(centers_[x], centers_[y]))) {
+          ++x;
+          continue;
+        }
+        const int x_begin = x;
+        while (x < resolution_ &&
+               contains(Eigen::Vector2d(centers_[x], centers_[y]))) {
+          ++x;
+        }
+        while (open < open_rects.size() &&
+               rects[open_rects[open]].x_begin < x_begin) {
+          ++open;
+        }
+        if (open < open_rects.size() &&
+            rects[open_rects[open]].x_begin == x_begin &&
+            rects[open_rects[open]].x_end == x) {
+          ++rects[open_rects[open]].y_end;
+          next_open_rects.push_back(open_rects[open]);
+        } else {
+          next_open_rects.push_back(rects.size());
+          rects.push_back(CellRect{x_begin, y, x, y + 1});
+        }
+      }
+      open_rects.swap(next_open_rects);
+    }
+    return rects;
+  }
+
+  InfectionStateHistogram CountInRegion(
+      const std::vector<CellRect>& rects) const {
+    InfectionStateHistogram counts = {};
+    for (const CellRect& rect : rects) {
+      const InfectionStateHistogram block_counts = CountInCells(rect);
+      for (int state = 0; state < kNumInfectionStates; ++state) {
+        counts[state] += block_counts[state];
+      }
+    }
+    return counts;
+  }
+
+private:
+  // Writes the ranges of cells whose centers lie in the wrapped interval
+  // [min, max) into |ranges| as (begin, end) pairs and returns their number,
+  // at most two.
+  int CellRangesOfInterval(double min, double max, int* ranges) const {
+    if (max - min >= 1.0) {
+      ranges[0] = 0;
+      ranges[1] = resolution_;
+      return 1;
+    }
+    const double begin = min - std::floor(min);
+    const double end = begin + (max - min);
+    const auto first_cell_from = [this](double coordinate) {
+      return static_cast<int>(
+          std::lower_bound(centers_.begin(), centers_.end(), coordinate) -
+          centers_.begin());
+    };
+    ranges[0] = first_cell_from(begin);
+    if (end <= 1.0) {
+      ranges[1] = first_cell_from(end);
+      return 1;
+    }
+    ranges[1] = resolution_;
+    ranges[2] = 0;
+    ranges[3] = first_cell_from(end - 1.0);
+    return 2;
+  }
+
+  int resolution_ = 0;
+  // Center of each column's, or row's, part of the unit square.
+  std::vector<double> centers_;
+  // (resolution_ + 1)^2 corners, row by row.
+  std::vector<InfectionStateHistogram> sums_;
+};
@@ -0,0 +1,92 @@
+#include "region_statistics.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+using Eigen::Vector2d;
+
+// Subjects at random positions, every third one recovered, binned into
+// |grid|.
+void AddSubjects(int count, SubjectStore* subjects,
+                 CellGrid<SubjectIndex>* grid) {
+  for (int i = 0; i < count; ++i) {
+    subjects->emplace_back(Vector2d(GenerateNormalizedUniformRandomNumber(),
+                                    GenerateNormalizedUniformRandomNumber()));
+    if (i % 3 == 0)
+      subjects->back().SetRecovered();
+  }
+  grid->BulkLoad(subjects->size(), [&](SubjectIndex index) {
+    return (*subjects)[index].GetPosition();
+  });
+}
+
+// Counts by a full scan, assigning every subject the center of the part of
+// its cell that lies in the unit square.
+template <typename ContainsFn>
+InfectionStateHistogram CountByScan(const SubjectStore& subjects,
+                                    double cell_size,
+                                    const ContainsFn& contains) {
+  InfectionStateHistogram counts = {};
+  for (const Subject& subject : subjects) {
+    Vector2d center;
+    for (int i = 0; i < 2; ++i) {
+      const double cell_min =
+          std::floor(subject.GetPosition()[i] / cell_size) * cell_size;
+      center[i] = (cell_min + std::min(cell_min + cell_size, 1.0)) / 2.0;
+    }
+    if (contains(center))
+      ++counts[static_cast<int>(subject.GetInfectionState())];
+  }
+  return counts;
+}
+
+}  // namespace
+
+TEST(RegionStatisticsTest, CountInRectMatchesScan) {
+  // The last row and column of cells reach past the unit square.
+  CellGrid<SubjectIndex> grid(0.3);
+  SubjectStore subjects;
+  AddSubjects(1000, &subjects, &grid);
+  WorkerPool worker_pool(0);
+  RegionStatistics statistics;
+  statistics.Build(grid, subjects, &worker_pool);
+
+  const std::vector<std::pair<Vector2d, Vector2d>> rects = {
+      {Vector2d(0.0, 0.0), Vector2d(1.0, 1.0)},
+      {Vector2d(0.1, 0.2), Vector2d(0.5, 0.9)},
+      {Vector2d(0.8, -0.2), Vector2d(1.2, 0.5)},
+      {Vector2d(0.9, 0.9), Vector2d(1.0, 1.0)}};
+  for (const auto& [min_corner, max_corner] : rects) {
+    const Vector2d extent = max_corner - min_corner;
+    const auto contains = [&](const Vector2d& position) {
+      for (int i = 0; i < 2; ++i) {
+        const double offset = position[i] - min_corner[i];
+        if (offset - std::floor(offset) >= extent[i] && extent[i] < 1.0)
+          return false;
+      }
+      return true;
+    };
+    EXPECT_EQ(statistics.CountInRect(min_corner, max_corner),
+              CountByScan(subjects, 0.3, contains))
+        << min_corner.transpose() << " " << max_corner.transpose();
+  }
+}
+
+TEST(RegionStatisticsTest, CountInRegionMatchesScan) {
+  CellGrid<SubjectIndex> grid(0.05);
+  SubjectStore subjects;
+  AddSubjects(5000, &subjects, &grid);
+  WorkerPool worker_pool(0);
+  RegionStatistics statistics;
+  statistics.Build(grid, subjects, &worker_pool);
+
+  // A disk with a hole.
+  const auto contains = [](const Vector2d& position) {
+    const double distance = (position - Vector2d(0.5, 0.4)).norm();
+    return distance < 0.3 && distance > 0.1;
+  };
+  const std::vector<CellRect> rects = statistics.DecomposeRegion(contains);
+  EXPECT_LT(rects.size(), 40);
+  EXPECT_EQ(statistics.CountInRegion(rects),
+            CountByScan(subjects, 0.05, contains));
+}
@@ -55,7 +55,7 @@ class Renderer::Impl {
    Impl() { egl_session_ = CreateEglSession(Eigen::Vector2i(1000, 1000)); }
 
   void Init(int subject_count);
-  void RenderFrame(const std::vector<Subject> &subjects);
+  void RenderFrame(const SubjectStore &subjects);
 
  private:
   std::unique_ptr<EglSession> egl_session_;
@@ -103,7 +103,7 @@ void Renderer::Impl::Init(int subject_count) {
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
-void Renderer::Impl::RenderFrame(const std::vector<Subject> &subjects) {
+void Renderer::Impl::RenderFrame(const SubjectStore &subjects) {
   const auto duration_since_start =
       start_time_ - std::chrono::system_clock::now();
   // move a vertex
@@ -143,6 +143,6 @@ Renderer::~Renderer() {}
 
 void Renderer::Init(int subject_count) { impl_->Init(subject_count); }
 
-void Renderer::RenderFrame(const std::vector<Subject> &subjects) {
+void Renderer::RenderFrame(const SubjectStore &subjects) {
   impl_->RenderFrame(subjects);
 }
@@ -1,4 +1,4 @@
-#include "subject.h"
+#include "subject_store.h"
 #include <memory>
 #include <vector>
 
@@ -7,7 +7,7 @@ class Renderer {
   Renderer();
   ~Renderer();
   void Init(int subject_count);
-  void RenderFrame(const std::vector<Subject> &subjects);
+  void RenderFrame(const SubjectStore &subjects);
 
 private:
   class Impl;
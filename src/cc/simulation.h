@@ -1,74 +1,472 @@
 #pragma once
 
+#include "arena.h"
 #include "subject.h"
+#include "subject_store.h"
 #include "cell_grid.h"
+#include "count_pyramid.h"
+#include "density_raster.h"
+#include "force_of_infection_field.h"
+#include "region_statistics.h"
+#include "simulation_config.h"
+#include "snapshot_mailbox.h"
+#include "space_filling_curve.h"
+#include "transmission_sampler.h"
+#include "verlet_neighbor_list.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <numeric>
 
-constexpr double kDistanceToInfect = 0.005;
-constexpr double kInfectionProbability = 0.02;
+// How often subjects are re-sorted along a Hilbert curve, in simulated time.
+// Subjects move about 1e-3 units per tick, so after a week they have drifted
+// across several cells.
+constexpr int kTicksPerReorder = 24 * 7;
+
+// Subjects generated from one random stream during initialization.
+constexpr int kSubjectsPerInitBatch = 1 << 16;
+
+// Subjects per read-ahead hint when the subjects live in a file: about 3 MB.
+constexpr int kSubjectsPerReadAhead = 1 << 18;
 
 class Simulation {
 public:
-  const std::vector<Subject>& GetSubjects() { return subjects_; }
+  // Runs the parallel phases on |worker_count| threads besides the calling
+  // one.
+  explicit Simulation(const SimulationConfig& config = SimulationConfig(),
+                      int worker_count = WorkerPool::DefaultWorkerCount())
+      : config_(config),
+        pair_infection_probability_(config.GetPairInfectionProbability()),
+        worker_pool_(worker_count) {
+    assert(config_.IsValid());
+  }
+
+  const SimulationConfig& GetConfig() const { return config_; }
+
+  // Replaces the model parameters from any thread, e.g. while the UI thread
+  // tunes a running simulation. The parameters take effect at the start of
+  // the next Update, so every phase of a tick and every worker thread sees
+  // one consistent version. If several configs arrive within one tick, only
+  // the last one is applied. The population does not change, so
+  // |subject_count| is ignored. Returns the version of |config|.
+  uint64_t PublishConfig(const SimulationConfig& config) {
+    assert(config.IsValid());
+    return published_configs_.Publish(config);
+  }
+
+  // Version of the config in effect, as returned by PublishConfig, or 0 for
+  // the one passed to the constructor.
+  uint64_t GetConfigVersion() const { return config_version_; }
+
+  const SubjectStore& GetSubjects() const { return subjects_; }
+
+  // Stable id of the subject at |index|. Indices change whenever subjects are
+  // reordered, ids stay the same for the lifetime of the simulation.
+  SubjectIndex GetSubjectId(SubjectIndex index) const {
+    return subject_ids_[index];
+  }
+
+  // Switches the infection phase from scanning grid neighborhoods every tick
+  // to per-subject candidate lists that include everyone within the
+  // infection distance plus |skin| and are only rebuilt once some subject has
+  // moved more than |skin| / 2. Trades memory for grid traversals; pays off
+  // when subjects move slowly relative to the infection radius. Must be
+  // called before Init.
+  void EnableVerletLists(double skin) {
+    assert(!cell_grid_);
+    verlet_skin_ = skin;
+  }
+
+  // Replaces pairwise contact testing with a force-of-infection field:
+  // contagious subjects are deposited onto a |resolution| x |resolution|
+  // grid that is convolved with |kernel| via FFT, and every susceptible
+  // subject samples its infection from the field at its position.
+  void EnableForceOfInfectionField(const ForceOfInfectionField::Kernel& kernel,
+                                   int resolution = 512) {
+    field_ = std::make_unique<ForceOfInfectionField>(kernel, resolution);
+  }
+
+  // Tests contacts only once |interval| ticks of simulated time have passed
+  // since the last check, while subjects still move in every Update. Each
+  // check stands for the exposure of all ticks since the last one, however
+  // long the steps were: the per-pair probability becomes 1 - (1 - p)^ticks,
+  // so that a pair that stays in contact transmits as often as before, and
+  // the hazard of a force-of-infection field is multiplied by the ticks.
+  // Infections are then only timed to the interval, and contacts shorter
+  // than it are seen only if they overlap a check.
+  void SetInfectionCheckInterval(int interval) {
+    assert(interval >= 1);
+    infection_check_interval_ = interval;
+  }
 
+  // Keeps per-state counts over regions up to date for GetRegionStatistics.
+  // They are rebuilt at the end of every Update, in O(N) on all threads, and
+  // also right away. Call after Init.
+  void EnableRegionStatistics() {
+    region_statistics_ = std::make_unique<RegionStatistics>();
+    region_statistics_->Build(*cell_grid_, subjects_, &worker_pool_);
+  }
+
+  // Counts as of the end of the last Update, or of EnableRegionStatistics if
+  // that came later.
+  const RegionStatistics& GetRegionStatistics() const {
+    assert(region_statistics_);
+    return *region_statistics_;
+  }
+
+  // Keeps a CountPyramid of the subjects for zoomable maps. Unlike region
+  // statistics it is updated incrementally, by the subjects that change cells
+  // or state in a tick. Call after Init.
+  void EnableCountPyramid() {
+    count_pyramid_ = std::make_unique<CountPyramid>(
+        cell_grid_->GetResolution(), cell_grid_->GetCellSize());
+    count_pyramid_->Build(*cell_grid_, subjects_);
+  }
+
+  const CountPyramid& GetCountPyramid() const {
+    assert(count_pyramid_);
+    return *count_pyramid_;
+  }
+
+#ifndef __EMSCRIPTEN__
+  // Keeps the subjects in a memory-mapped file at |path| instead of on the
+  // heap, for populations that do not fit into memory. Returns false if the
+  // file cannot be created.
+  bool MapSubjectsToFile(const std::string& path) {
+    return subjects_.MapFile(path);
+  }
+#endif
+
+  // Places |subject_count| subjects uniformly at random and infects one.
   void Init(int subject_count) {
+    InitEmpty(subject_count);
+    GenerateSubjects(subject_count, [](std::default_random_engine* engine) {
+      std::uniform_real_distribution<double> uniform(0.0, 1.0);
+      return Eigen::Vector2d(uniform(*engine), uniform(*engine));
+    });
+  }
+
+  // Like Init, but places subjects in proportion to |density|.
+  void InitFromDensity(const DensityRaster& density, int subject_count) {
+    InitEmpty(subject_count);
+    GenerateSubjects(subject_count, [&](std::default_random_engine* engine) {
+      return density.SamplePosition(engine);
+    });
+  }
+
+#ifndef __EMSCRIPTEN__
+  // Starts from the population in the file at |path|, as left behind by a
+  // simulation that called MapSubjectsToFile and Init or InitFromDensity.
+  // Subjects keep their positions and infection states. The file is mapped
+  // copy-on-write and stays unchanged. Returns false if it cannot be read.
+  bool InitFromFile(const std::string& path) {
+    if (!subjects_.MapExistingFile(path))
+      return false;
+    InitEmpty(subjects_.size());
+    subject_ids_.resize(subjects_.size());
+    std::iota(subject_ids_.begin(), subject_ids_.end(), 0);
+    next_subject_id_ = subjects_.size();
+    // A saved population is already in curve order, so this only rebuilds
+    // the grid and does not write to the mapping.
+    ReorderSubjects();
+    return true;
+  }
+#endif
+
+  // Sets up a simulation without subjects whose grid is sized for a
+  // population of |expected_subject_count|. Subjects are then added with
+  // AddSubject.
+  void InitEmpty(int expected_subject_count) {
     start_time_ = time_;
-    subjects_.reserve(subject_count);
+    last_infection_check_time_ = time_;
+    CreateCellGrid(expected_subject_count);
+    CountSubjects();
+  }
 
-    const double recommended_cell_size =
-        1.0 / std::sqrt(static_cast<double>(subject_count));
-    const double cell_size = std::max(recommended_cell_size, kDistanceToInfect);
-    cell_grid_ = std::make_unique<CellGrid<Subject*>>(cell_size);
+  SubjectIndex AddSubject(const Subject& subject) {
+    assert(subjects_.size() < std::numeric_limits<SubjectIndex>::max());
+    const SubjectIndex index = subjects_.size();
+    subjects_.push_back(subject);
+    subject_ids_.push_back(next_subject_id_++);
+    CountSubject(subject, 1);
+    cell_grid_->Add(index, subject.GetPosition());
+    if (subject.IsContagious())
+      cell_grid_->AddMark(subject.GetPosition());
+    if (count_pyramid_) {
+      count_pyramid_->Add(cell_grid_->GetCellIdOf(index),
+                          subject.GetInfectionState(), 1);
+    }
+    if (verlet_list_)
+      verlet_list_->Invalidate();
+    return index;
+  }
 
-    for (int i = 0; i < subject_count; ++i) {
-      const Eigen::Vector2d p(GenerateNormalizedUniformRandomNumber(),
-                              GenerateNormalizedUniformRandomNumber());
-      subjects_.emplace_back(p);
-      cell_grid_->Add(&subjects_.back(), p);
+  // Removes the subject at |index| by moving the last subject into its place,
+  // so only the index of the last subject changes.
+  void RemoveSubject(SubjectIndex index) {
+    const SubjectIndex last = subjects_.size() - 1;
+    const Subject& subject = subjects_[index];
+    CountSubject(subject, -1);
+    if (count_pyramid_) {
+      count_pyramid_->Add(cell_grid_->GetCellIdOf(index),
+                          subject.GetInfectionState(), -1);
     }
-    for (int i = 0; i < subject_count; ++i) {
-      //std::cout << "-subject: " << &subjects_[i] << std::endl;
+    cell_grid_->Remove(index, subject.GetPosition());
+    if (subject.IsContagious())
+      cell_grid_->RemoveMark(subject.GetPosition());
+    if (index != last) {
+      cell_grid_->Remove(last, subjects_[last].GetPosition());
+      cell_grid_->Add(index, subjects_[last].GetPosition());
+      subjects_[index] = subjects_[last];
+      subject_ids_[index] = subject_ids_[last];
     }
-    subjects_[0].MaybeInfect(time_);
+    subjects_.pop_back();
+    subject_ids_.pop_back();
+    if (verlet_list_)
+      verlet_list_->Invalidate();
   }
 
-  void Update(Duration dt) {
-    assert(cell_grid_);
-    std::vector<Subject*> neighbors;
+  void Infect(SubjectIndex index) {
+    if (!subjects_[index].IsSusceptible())
+      return;
+    subjects_[index].MaybeInfect(config_);
+    CountNewInfections(1);
+  }
+
+  const CellGrid<SubjectIndex>& GetCellGrid() const { return *cell_grid_; }
 
+  void Update(Tick dt) {
+    assert(cell_grid_);
+    ApplyPublishedConfig();
+    const Tick previous_time = time_;
     time_ += dt;
+
+    // Move subjects and advance their infection states. Every subject only
+    // touches its own state, so this runs on all threads. Each thread walks
+    // its range in order and asks for the next block ahead of time.
+    previous_states_.resize(subjects_.size());
+    const StepMotion motion(dt, config_);
+    worker_pool_.ParallelFor(subjects_.size(), [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        if ((i - begin) % kSubjectsPerReadAhead == 0)
+          subjects_.WillNeed(i + kSubjectsPerReadAhead,
+                             i + 2 * kSubjectsPerReadAhead);
+        previous_states_[i] = subjects_[i].GetInfectionState();
+        subjects_[i].Update(dt, config_, motion);
+      }
+    });
+
+    // Re-bin moved subjects and keep the grid's per-cell count of contagious
+    // subjects, and the count pyramid, in sync with moves and state
+    // transitions. Most subjects stay within their cell in the same state,
+    // which costs only the cell lookup. The same pass keeps the counts that
+    // ComputeActivity reads: every subject that had caught the infection is
+    // contagious now.
+    pending_infection_count_ = 0;
+    min_ticks_to_transition_ = std::numeric_limits<Tick>::max();
     for (int i = 0; i < subjects_.size(); ++i) {
-      Subject* subject1 = &subjects_[i];
-      //std::cout << "subject: " << subject1 << std::endl;
-      cell_grid_->Remove(subject1, subject1->GetPosition());
-      subject1->Update(time_, dt);
-      cell_grid_->Add(subject1, subject1->GetPosition());
+      const Subject& subject = subjects_[i];
+      const int previous_cell_id = cell_grid_->GetCellIdOf(i);
+      const bool changed_cells = cell_grid_->Move(i, subject.GetPosition());
+      const InfectionState state = subject.GetInfectionState();
+      const InfectionState previous_state = previous_states_[i];
+      if (const std::optional<Tick> ticks_to_transition =
+              subject.GetTicksToNextTransition()) {
+        min_ticks_to_transition_ =
+            std::min(min_ticks_to_transition_, *ticks_to_transition);
+      }
+      if (!changed_cells && state == previous_state)
+        continue;
+      if (state != previous_state) {
+        --state_counts_[static_cast<int>(previous_state)];
+        ++state_counts_[static_cast<int>(state)];
+      }
+      const int cell_id = cell_grid_->GetCellIdOf(i);
+      if (changed_cells ||
+          IsContagious(state) != IsContagious(previous_state)) {
+        if (IsContagious(previous_state))
+          cell_grid_->RemoveMarkFromCell(previous_cell_id);
+        if (IsContagious(state))
+          cell_grid_->AddMarkToCell(cell_id);
+      }
+      if (count_pyramid_) {
+        count_pyramid_->Add(previous_cell_id, previous_state, -1);
+        count_pyramid_->Add(cell_id, state, 1);
+      }
+    }
 
-      cell_grid_->GetNeighbors(subject1->GetPosition(), &neighbors);
-      //std::cout << "neighbors: " << neighbors.size();
-      for (int j = 0; j < neighbors.size(); ++j) {
-        Subject* subject2 = neighbors[j];
-        MaybePairwiseInfect(subject1, subject2);
+    const Tick ticks_since_infection_check = time_ - last_infection_check_time_;
+    if (ticks_since_infection_check >= infection_check_interval_) {
+      last_infection_check_time_ = time_;
+      UpdatePairInfectionProbability(ticks_since_infection_check);
+      if (field_) {
+        InfectFromField(ticks_since_infection_check);
+      } else {
+        InfectFromNeighbors();
       }
-      //for (int j = i; j < subjects_.size(); ++j) {
-      //  Subject* subject2 = &subjects_[j];
-      //  MaybePairwiseInfect(subject1, subject2);
-      //}
     }
+
+    // Once per kTicksPerReorder of simulated time, however long the steps.
+    if (time_ / kTicksPerReorder != previous_time / kTicksPerReorder)
+      ReorderSubjects();
+
+    if (region_statistics_)
+      region_statistics_->Build(*cell_grid_, subjects_, &worker_pool_);
+  }
+
+  // Advances the clock without moving subjects or testing contacts. Only valid
+  // while no subject is infected, when nothing can change anyway.
+  void FastForward(Tick dt) {
+    assert(!ComputeActivity().any_infected);
+    time_ += dt;
+    last_infection_check_time_ = time_;
   }
 
-  void MaybePairwiseInfect(Subject *subject1, Subject *subject2) {
-    const Eigen::Vector2d diff =
-        (subject1->GetPosition() - subject2->GetPosition());
-    if (diff.squaredNorm() < kDistanceToInfect * kDistanceToInfect) {
-      if (GenerateNormalizedUniformRandomNumber() > kInfectionProbability)
-        return;
-      if (subject1->IsContagious())
-        subject2->MaybeInfect(time_);
-      if (subject2->IsContagious())
-        subject1->MaybeInfect(time_);
+  // What can still happen in the simulation, so that callers can size their
+  // next step.
+  struct Activity {
+    // Some subject is infected and has not recovered yet.
+    bool any_infected = false;
+    bool any_susceptible = false;
+    // Some susceptible subject could catch the infection in the next step,
+    // i.e. shares a grid neighborhood with a contagious subject (or, with a
+    // force-of-infection field, any subject is contagious), or some subject
+    // was just infected and turns contagious in the next step.
+    bool any_exposed = false;
+    Tick time_to_next_transition = std::numeric_limits<Tick>::max();
+    // Lower bound on the distance between any susceptible and any contagious
+    // subject.
+    double susceptible_distance = std::numeric_limits<double>::infinity();
+  };
+
+  // Reads the counts kept by Update, AddSubject, RemoveSubject and Infect,
+  // and only scans the active tiles when the epidemic could spread. A
+  // susceptible subject outside the active tiles is a whole tile away from
+  // every contagious one, and one in an active tile but not exposed is a
+  // whole cell away.
+  Activity ComputeActivity() const {
+    Activity activity;
+    const int64_t contagious_count =
+        GetStateCount(InfectionState::kInfectedWithoutSymptoms) +
+        GetStateCount(InfectionState::kInfectedWithSymptoms);
+    activity.any_susceptible =
+        GetStateCount(InfectionState::kUninfected) > pending_infection_count_;
+    activity.any_exposed = pending_infection_count_ > 0;
+    activity.any_infected = activity.any_exposed || contagious_count > 0;
+    if (activity.any_infected)
+      activity.time_to_next_transition = min_ticks_to_transition_;
+    if (!activity.any_susceptible || contagious_count == 0)
+      return activity;
+    if (field_) {
+      activity.any_exposed = true;
+      activity.susceptible_distance = 0.0;
+      return activity;
+    }
+
+    const double min_cell_extent = cell_grid_->GetMinCellExtent();
+    activity.susceptible_distance = cell_grid_->GetMinTileExtent();
+    ScratchArena::Scope scratch_scope;
+    ScratchVector<int> cell_ids;
+    for (const int tile_id : cell_grid_->GetActiveTiles()) {
+      cell_grid_->GetCellsOfTile(tile_id, &cell_ids);
+      for (const int cell_id : cell_ids) {
+        const bool is_marked = cell_grid_->IsNeighborhoodMarked(cell_id);
+        if (!is_marked && activity.susceptible_distance <= min_cell_extent)
+          continue;
+        for (const SubjectIndex index : cell_grid_->GetCell(cell_id)) {
+          if (!subjects_[index].IsSusceptible())
+            continue;
+          if (is_marked) {
+            activity.any_exposed = true;
+            activity.susceptible_distance = 0.0;
+            return activity;
+          }
+          activity.susceptible_distance = min_cell_extent;
+          break;
+        }
+      }
+    }
+    return activity;
+  }
+
+  // Permutes subjects_ along a Hilbert curve so that subjects in the same and
+  // adjacent cells are adjacent in memory, and rebuilds the grid to match.
+  // The permutation is applied in place, so a file-backed population is
+  // never copied into memory.
+  //
+  // The curve only needs to be about as fine as the population, one subject
+  // per curve cell on average, which keeps the number of distinct keys
+  // within the population size and lets a counting sort order them in O(N).
+  void ReorderSubjects() {
+    const int order = std::clamp(
+        static_cast<int>(std::log2(std::max<size_t>(subjects_.size(), 1)) / 2),
+        1, 15);
+    reorder_keys_.resize(subjects_.size());
+    worker_pool_.ParallelFor(subjects_.size(), [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        reorder_keys_[i] =
+            HilbertIndexFromPosition(subjects_[i].GetPosition(), order);
+      }
+    });
+    reorder_offsets_.assign((SubjectIndex{1} << (2 * order)) + 1, 0);
+    for (const SubjectIndex key : reorder_keys_) {
+      ++reorder_offsets_[key + 1];
+    }
+    std::partial_sum(reorder_offsets_.begin(), reorder_offsets_.end(),
+                     reorder_offsets_.begin());
+    reorder_sources_.resize(subjects_.size());
+    for (SubjectIndex i = 0; i < subjects_.size(); ++i) {
+      reorder_sources_[reorder_offsets_[reorder_keys_[i]]++] = i;
+    }
+
+    // Follow each cycle of the permutation, marking visited slots by making
+    // them point to themselves.
+    for (SubjectIndex start = 0; start < subjects_.size(); ++start) {
+      if (reorder_sources_[start] == start)
+        continue;
+      const Subject subject = subjects_[start];
+      const SubjectIndex id = subject_ids_[start];
+      SubjectIndex slot = start;
+      while (reorder_sources_[slot] != start) {
+        const SubjectIndex source = reorder_sources_[slot];
+        subjects_[slot] = subjects_[source];
+        subject_ids_[slot] = subject_ids_[source];
+        reorder_sources_[slot] = slot;
+        slot = source;
+      }
+      subjects_[slot] = subject;
+      subject_ids_[slot] = id;
+      reorder_sources_[slot] = slot;
+    }
+
+    if (verlet_list_)
+      verlet_list_->Invalidate();
+    cell_grid_->BulkLoad(subjects_.size(), [this](SubjectIndex index) {
+      return subjects_[index].GetPosition();
+    });
+    for (int i = 0; i < subjects_.size(); ++i) {
+      if (subjects_[i].IsContagious())
+        cell_grid_->AddMark(subjects_[i].GetPosition());
     }
   }
 
+  // Lets |sampler| decide whether |other| infects |subject| if |other| is
+  // contagious and within the configured distance. Returns whether |subject|
+  // gets infected; the caller applies the infection.
+  bool MaybePairwiseInfect(const Subject& subject, const Subject& other,
+                           TransmissionSampler* sampler) const {
+    if (!other.IsContagious())
+      return false;
+    const Eigen::Vector2d diff = subject.GetPosition() - other.GetPosition();
+    const double distance_to_infect = config_.distance_to_infect;
+    if (diff.squaredNorm() >= distance_to_infect * distance_to_infect)
+      return false;
+    return sampler->Attempt();
+  }
+
   std::string ToString() const {
     std::stringstream ss;
     for (const auto &subject : subjects_) {
@@ -79,8 +477,8 @@ public:
   }
 
 
-  std::vector<int> ComputeInfectionStateHistogram() {
-    std::vector<int> infection_state_counts_(kNumInfectionStates);
+  InfectionStateHistogram ComputeInfectionStateHistogram() const {
+    InfectionStateHistogram infection_state_counts_ = {};
     for (int i = 0; i < subjects_.size(); ++i) {
       const InfectionState infection_state = subjects_[i].GetInfectionState();
       ++infection_state_counts_[static_cast<int>(infection_state)];
@@ -88,12 +486,378 @@ public:
     return infection_state_counts_;
   }
 
-  Duration GetElapsedSimulationTime() const { return time_ - start_time_; }
+  Tick GetElapsedSimulationTime() const { return time_ - start_time_; }
+
+  // Spatial queries for inspecting a region, e.g. around a click. They only
+  // visit the grid cells that overlap the region, so their cost follows the
+  // number of subjects nearby rather than the population. Regions wrap
+  // around the domain edges like subject moves do.
+
+  // Returns the subjects within |radius| of |center|.
+  template <typename Allocator>
+  void GetSubjectsInRadius(
+      const Eigen::Vector2d& center, double radius,
+      std::vector<SubjectIndex, Allocator>* indices) const {
+    indices->clear();
+    ForEachSubjectInRadius(center, radius, [&](SubjectIndex index) {
+      indices->push_back(index);
+    });
+  }
+
+  // Returns the subjects in the rectangle from |min_corner| to |max_corner|.
+  // Corners outside the unit square wrap around.
+  template <typename Allocator>
+  void GetSubjectsInRect(const Eigen::Vector2d& min_corner,
+                         const Eigen::Vector2d& max_corner,
+                         std::vector<SubjectIndex, Allocator>* indices) const {
+    indices->clear();
+    ForEachSubjectInRect(min_corner, max_corner, [&](SubjectIndex index) {
+      indices->push_back(index);
+    });
+  }
+
+  InfectionStateHistogram CountSubjectsInRadius(const Eigen::Vector2d& center,
+                                                double radius) const {
+    InfectionStateHistogram counts = {};
+    ForEachSubjectInRadius(center, radius, [&](SubjectIndex index) {
+      ++counts[static_cast<int>(subjects_[index].GetInfectionState())];
+    });
+    return counts;
+  }
+
+  InfectionStateHistogram CountSubjectsInRect(
+      const Eigen::Vector2d& min_corner,
+      const Eigen::Vector2d& max_corner) const {
+    InfectionStateHistogram counts = {};
+    ForEachSubjectInRect(min_corner, max_corner, [&](SubjectIndex index) {
+      ++counts[static_cast<int>(subjects_[index].GetInfectionState())];
+    });
+    return counts;
+  }
 
 private:
-  std::vector<Subject> subjects_;
-  std::unique_ptr<CellGrid<Subject*>> cell_grid_;
-  Time start_time_;
-  Time time_;
+  // Calls fn(index) for every subject whose position lies in the wrapped
+  // rectangle from |min_corner| to |max_corner|.
+  template <typename Fn>
+  void ForEachSubjectInRect(const Eigen::Vector2d& min_corner,
+                            const Eigen::Vector2d& max_corner,
+                            const Fn& fn) const {
+    const Eigen::Vector2d extent = max_corner - min_corner;
+    const auto contains = [&](const Eigen::Vector2d& position) {
+      for (int i = 0; i < 2; ++i) {
+        const double offset = position[i] - min_corner[i];
+        if (extent[i] < 1.0 && offset - std::floor(offset) > extent[i])
+          return false;
+      }
+      return true;
+    };
+    ScratchArena::Scope scratch_scope;
+    ScratchVector<int> cell_ids;
+    cell_grid_->GetCellsInRect(min_corner, max_corner, &cell_ids);
+    for (const int cell_id : cell_ids) {
+      for (const SubjectIndex index : cell_grid_->GetCell(cell_id)) {
+        if (contains(subjects_[index].GetPosition()))
+          fn(index);
+      }
+    }
+  }
+
+  // Calls fn(index) for every subject within |radius| of |center|, taking
+  // the shortest way around the domain.
+  template <typename Fn>
+  void ForEachSubjectInRadius(const Eigen::Vector2d& center, double radius,
+                              const Fn& fn) const {
+    const Eigen::Vector2d half_extent = Eigen::Vector2d::Constant(radius);
+    ForEachSubjectInRect(
+        center - half_extent, center + half_extent, [&](SubjectIndex index) {
+          Eigen::Vector2d offset = subjects_[index].GetPosition() - center;
+          offset[0] -= std::round(offset[0]);
+          offset[1] -= std::round(offset[1]);
+          if (offset.squaredNorm() <= radius * radius)
+            fn(index);
+        });
+  }
+
+  // Sets the probability that a pair in contact transmits over
+  // |exposure_ticks| ticks.
+  void UpdatePairInfectionProbability(Tick exposure_ticks) {
+    pair_infection_probability_ =
+        1.0 - std::pow(1.0 - config_.GetPairInfectionProbability(),
+                       static_cast<double>(exposure_ticks));
+  }
+
+  // Switches to the latest config from PublishConfig, if there is a new one.
+  // Subjects keep their transition timers; new timings apply from their next
+  // transition on. A larger infection distance can outgrow the grid's cells,
+  // in which case the grid is rebuilt with larger ones.
+  void ApplyPublishedConfig() {
+    SimulationConfig config;
+    uint64_t version;
+    if (!published_configs_.Take(&config, &version))
+      return;
+    config.subject_count = config_.subject_count;
+    const bool distance_changed =
+        config.distance_to_infect != config_.distance_to_infect;
+    config_ = config;
+    config_version_ = version;
+    if (!distance_changed)
+      return;
+    if (config_.distance_to_infect + verlet_skin_ >
+        cell_grid_->GetCellSize()) {
+      CreateCellGrid(subjects_.size());
+      ReorderSubjects();
+      if (count_pyramid_)
+        EnableCountPyramid();
+    } else if (verlet_list_) {
+      verlet_list_ = std::make_unique<VerletNeighborList>(
+          config_.distance_to_infect, verlet_skin_);
+    }
+  }
+
+  // Creates an empty grid sized for |expected_subject_count| subjects, with
+  // cells no smaller than the infection distance, so that contacts are
+  // always within a cell's 3x3 neighborhood.
+  void CreateCellGrid(int expected_subject_count) {
+    const int subject_count = std::max(expected_subject_count, 1);
+    const double recommended_cell_size =
+        1.0 / std::sqrt(static_cast<double>(subject_count));
+    const double cell_size =
+        std::max(recommended_cell_size,
+                 config_.distance_to_infect + verlet_skin_);
+    cell_grid_ = std::make_unique<CellGrid<SubjectIndex>>(cell_size);
+    cell_grid_->Reserve(subject_count);
+    if (verlet_skin_ > 0.0) {
+      verlet_list_ = std::make_unique<VerletNeighborList>(
+          config_.distance_to_infect, verlet_skin_);
+    }
+  }
+
+  // Replaces the population with |subject_count| subjects at positions drawn
+  // by position_of(engine), infects one of them and builds the grid. Subjects
+  // are generated in fixed batches on all threads, each from its own random
+  // stream seeded with the batch number, so the result depends only on the
+  // seed and not on how batches are spread over threads.
+  template <typename PositionFn>
+  void GenerateSubjects(int subject_count, const PositionFn& position_of) {
+    assert(subject_count <= std::numeric_limits<SubjectIndex>::max());
+    const uint32_t seed = GetRandomEngine()();
+    subjects_.resize(subject_count, Subject(Eigen::Vector2d::Zero(), 0.0));
+    const int num_batches =
+        (subject_count + kSubjectsPerInitBatch - 1) / kSubjectsPerInitBatch;
+    // Batches are large enough to be worth a thread each.
+    worker_pool_.ParallelFor(
+        num_batches,
+        [&](int begin, int end) {
+          std::uniform_real_distribution<double> uniform(0.0, 1.0);
+          for (int batch = begin; batch < end; ++batch) {
+            std::seed_seq stream_seed{seed, static_cast<uint32_t>(batch)};
+            std::default_random_engine engine(stream_seed);
+            const int first = batch * kSubjectsPerInitBatch;
+            const int last =
+                std::min(first + kSubjectsPerInitBatch, subject_count);
+            for (int i = first; i < last; ++i) {
+              const Eigen::Vector2d position = position_of(&engine);
+              subjects_[i] = Subject(position, uniform(engine) * 2.0 * M_PI);
+            }
+          }
+        },
+        /*min_parallel_count=*/2);
+    subject_ids_.resize(subject_count);
+    std::iota(subject_ids_.begin(), subject_ids_.end(), 0);
+    next_subject_id_ = subject_count;
+    if (subject_count > 0)
+      subjects_[0].MaybeInfect(config_);
+    CountSubjects();
+
+    // Also populates the grid.
+    ReorderSubjects();
+  }
+
+  int64_t GetStateCount(InfectionState state) const {
+    return state_counts_[static_cast<int>(state)];
+  }
+
+  // Adds |sign| times |subject| to the counts that ComputeActivity reads.
+  void CountSubject(const Subject& subject, int sign) {
+    state_counts_[static_cast<int>(subject.GetInfectionState())] += sign;
+    const std::optional<Tick> ticks_to_transition =
+        subject.GetTicksToNextTransition();
+    if (!ticks_to_transition)
+      return;
+    if (subject.GetInfectionState() == InfectionState::kUninfected)
+      pending_infection_count_ += sign;
+    // A subject that is removed leaves the bound lower than needed, which
+    // only shortens the next step.
+    if (sign > 0) {
+      min_ticks_to_transition_ =
+          std::min(min_ticks_to_transition_, *ticks_to_transition);
+    }
+  }
+
+  // Recounts the whole population.
+  void CountSubjects() {
+    state_counts_ = {};
+    pending_infection_count_ = 0;
+    min_ticks_to_transition_ = std::numeric_limits<Tick>::max();
+    for (const Subject& subject : subjects_) {
+      CountSubject(subject, 1);
+    }
+  }
+
+  // Accounts for |count| susceptible subjects that just caught the infection.
+  void CountNewInfections(int64_t count) {
+    if (count == 0)
+      return;
+    pending_infection_count_ += count;
+    min_ticks_to_transition_ =
+        std::min(min_ticks_to_transition_, config_.GetTicksToSymptoms());
+  }
+
+  // Lets susceptible subjects catch the infection from contagious subjects
+  // within the configured distance.
+  void InfectFromNeighbors() {
+    if (verlet_list_ && verlet_list_->NeedsRebuild(subjects_, *cell_grid_))
+      verlet_list_->Build(subjects_, *cell_grid_);
+
+    // Only cells with a contagious subject in their 3x3 neighborhood can see
+    // a transmission; they all lie in the grid's active tiles, so the cost of
+    // this phase follows the epidemic frontier rather than the population.
+    // Tiles are processed on all threads. Subjects are only read there, as a
+    // subject's state shares its bytes with the timer that an infection
+    // sets. New infections are flagged in a byte per subject instead, and
+    // applied by a second pass over the same cells once all threads are done.
+    const std::vector<int>& active_tiles = cell_grid_->GetActiveTiles();
+    is_newly_infected_.resize(subjects_.size(), false);
+    worker_pool_.ParallelFor(active_tiles.size(), [&](int begin, int end) {
+      ScratchArena::Scope scratch_scope;
+      TransmissionSampler sampler(pair_infection_probability_);
+      ScratchVector<int> cell_ids;
+      ScratchVector<SubjectIndex> neighbors;
+      for (int i = begin; i < end; ++i) {
+        cell_grid_->GetCellsOfTile(active_tiles[i], &cell_ids);
+        for (const int cell_id : cell_ids) {
+          if (cell_grid_->IsNeighborhoodMarked(cell_id))
+            InfectCell(cell_id, &neighbors, &sampler);
+        }
+      }
+    });
+    std::atomic<int64_t> new_infection_count{0};
+    worker_pool_.ParallelFor(active_tiles.size(), [&](int begin, int end) {
+      ScratchArena::Scope scratch_scope;
+      ScratchVector<int> cell_ids;
+      int64_t count = 0;
+      for (int i = begin; i < end; ++i) {
+        cell_grid_->GetCellsOfTile(active_tiles[i], &cell_ids);
+        for (const int cell_id : cell_ids) {
+          if (!cell_grid_->IsNeighborhoodMarked(cell_id))
+            continue;
+          for (const SubjectIndex index : cell_grid_->GetCell(cell_id)) {
+            if (!is_newly_infected_[index])
+              continue;
+            is_newly_infected_[index] = false;
+            subjects_[index].MaybeInfect(config_);
+            ++count;
+          }
+        }
+      }
+      new_infection_count += count;
+    });
+    CountNewInfections(new_infection_count);
+  }
+
+  // Every susceptible subject catches the infection with the probability
+  // given by the hazard at its position, accumulated over |exposure_ticks|.
+  void InfectFromField(Tick exposure_ticks) {
+    field_->Clear();
+    for (const Subject& subject : subjects_) {
+      if (subject.IsContagious())
+        field_->Deposit(subject.GetPosition());
+    }
+    field_->Compute(&worker_pool_);
+
+    // Each subject only reads the field and writes itself.
+    std::atomic<int64_t> new_infection_count{0};
+    worker_pool_.ParallelFor(subjects_.size(), [&](int begin, int end) {
+      int64_t count = 0;
+      for (int i = begin; i < end; ++i) {
+        Subject* subject = &subjects_[i];
+        if (!subject->IsSusceptible())
+          continue;
+        const double hazard =
+            field_->Sample(subject->GetPosition()) * exposure_ticks;
+        if (hazard > 0.0 &&
+            GenerateNormalizedUniformRandomNumber() < -std::expm1(-hazard)) {
+          subject->MaybeInfect(config_);
+          ++count;
+        }
+      }
+      new_infection_count += count;
+    });
+    CountNewInfections(new_infection_count);
+  }
+
+  // Exposes the susceptible subjects in |cell_id| to their neighbors and
+  // flags those who catch the infection. All subjects of a cell share the
+  // same grid neighborhood, so it is gathered once into |neighbors|, unless
+  // Verlet lists are enabled.
+  void InfectCell(int cell_id, ScratchVector<SubjectIndex>* neighbors,
+                  TransmissionSampler* sampler) {
+    const auto& cell = cell_grid_->GetCell(cell_id);
+    if (cell.empty())
+      return;
+    if (!verlet_list_)
+      cell_grid_->GetNeighborsOfCell(cell_id, neighbors);
+
+    for (const SubjectIndex index : cell) {
+      const Subject& subject = subjects_[index];
+      if (!subject.IsSusceptible())
+        continue;
+      const SubjectIndex* begin = neighbors->data();
+      const SubjectIndex* end = neighbors->data() + neighbors->size();
+      if (verlet_list_) {
+        begin = verlet_list_->CandidatesBegin(index);
+        end = verlet_list_->CandidatesEnd(index);
+      }
+      for (const SubjectIndex* neighbor = begin; neighbor != end; ++neighbor) {
+        if (MaybePairwiseInfect(subject, subjects_[*neighbor], sampler)) {
+          is_newly_infected_[index] = true;
+          break;
+        }
+      }
+    }
+  }
+
+  SubjectStore subjects_;
+  std::vector<SubjectIndex> subject_ids_;
+  std::vector<InfectionState> previous_states_;
+  std::vector<SubjectIndex> reorder_keys_;
+  std::vector<SubjectIndex> reorder_offsets_;
+  std::vector<SubjectIndex> reorder_sources_;
+  // Subjects infected in the current infection phase, as bytes rather than
+  // bits so that threads can set them concurrently.
+  std::vector<uint8_t> is_newly_infected_;
+  // Subjects per infection state, how many of the uninfected have caught the
+  // infection and turn contagious with their next Update, and a lower bound
+  // on the ticks to the next transition, so that ComputeActivity does not
+  // scan the population.
+  InfectionStateHistogram state_counts_ = {};
+  int64_t pending_infection_count_ = 0;
+  Tick min_ticks_to_transition_ = std::numeric_limits<Tick>::max();
+  SimulationConfig config_;
+  uint64_t config_version_ = 0;
+  SnapshotMailbox<SimulationConfig> published_configs_;
+  std::unique_ptr<CellGrid<SubjectIndex>> cell_grid_;
+  std::unique_ptr<VerletNeighborList> verlet_list_;
+  std::unique_ptr<ForceOfInfectionField> field_;
+  std::unique_ptr<RegionStatistics> region_statistics_;
+  std::unique_ptr<CountPyramid> count_pyramid_;
+  double verlet_skin_ = 0.0;
+  int infection_check_interval_ = 1;
+  double pair_infection_probability_;
+  WorkerPool worker_pool_;
+  Tick start_time_ = 0;
+  Tick time_ = 0;
+  SubjectIndex next_subject_id_ = 0;
+  Tick last_infection_check_time_ = 0;
 };
 
@@ -0,0 +1,118 @@
+#pragma once
+#include "common.h"
+#include <array>
+#include <cmath>
+#include <optional>
+#include <string>
+
+// Defaults of the model parameters in SimulationConfig.
+constexpr int kDefaultSubjectCount = 5000;
+constexpr double kDistanceToInfect = 0.005;
+constexpr double kInfectionProbability = 0.02;
+constexpr double kDaysToSymptoms = 14;
+constexpr double kDaysSymptomsToRecovery = 10;
+constexpr double kSubjectVelocityUnitsPerSecond = 3e-7;
+constexpr double kSubjectAngleVolatilityPerSecond = 1e-3;
+
+// Each close pair used to be tested from both ends, transmitting with
+// kInfectionProbability each time. The infection phase now tests every
+// (susceptible, contagious) pair once, so it uses the combined probability.
+constexpr double kPairInfectionProbability =
+    1.0 - (1.0 - kInfectionProbability) * (1.0 - kInfectionProbability);
+
+constexpr Tick kTicksToSymptoms = kDaysToSymptoms * kTicksPerDay;
+constexpr Tick kTicksToRecovery =
+    (kDaysToSymptoms + kDaysSymptomsToRecovery) * kTicksPerDay;
+
+// Longest infection that Subject's packed transition timer can count down.
+constexpr Tick kMaxTicksToRecovery = (1 << 14) - 1;
+
+// Model parameters of a simulation run, so that sweeps and the web UI can
+// change them without recompiling. Defaults reproduce the constants above.
+struct SimulationConfig {
+  int subject_count = kDefaultSubjectCount;
+  double distance_to_infect = kDistanceToInfect;
+  // Per contact and tick, as seen from one end of a pair.
+  double infection_probability = kInfectionProbability;
+  double days_to_symptoms = kDaysToSymptoms;
+  double days_symptoms_to_recovery = kDaysSymptomsToRecovery;
+  double subject_velocity_units_per_second = kSubjectVelocityUnitsPerSecond;
+  double subject_angle_volatility_per_second =
+      kSubjectAngleVolatilityPerSecond;
+
+  // Names under which the UI refers to the parameters; the same as the
+  // members.
+  static constexpr std::array<const char*, 7> kParameterNames = {
+      "subject_count",
+      "distance_to_infect",
+      "infection_probability",
+      "days_to_symptoms",
+      "days_symptoms_to_recovery",
+      "subject_velocity_units_per_second",
+      "subject_angle_volatility_per_second"};
+
+  std::optional<double> GetParameter(const std::string& name) const {
+    if (name == "subject_count")
+      return subject_count;
+    const double* parameter =
+        const_cast<SimulationConfig*>(this)->FindParameter(name);
+    if (!parameter)
+      return std::nullopt;
+    return *parameter;
+  }
+
+  // Returns false if there is no parameter called |name|. Does not check
+  // whether the result IsValid().
+  bool SetParameter(const std::string& name, double value) {
+    if (name == "subject_count") {
+      subject_count = std::lround(value);
+      return true;
+    }
+    double* parameter = FindParameter(name);
+    if (!parameter)
+      return false;
+    *parameter = value;
+    return true;
+  }
+
+  bool IsValid() const {
+    return subject_count >= 0 && distance_to_infect > 0.0 &&
+           distance_to_infect < 0.5 && infection_probability >= 0.0 &&
+           infection_probability <= 1.0 && days_to_symptoms > 0.0 &&
+           GetTicksToSymptoms() >= 1 && days_symptoms_to_recovery > 0.0 &&
+           GetTicksToRecovery() > GetTicksToSymptoms() &&
+           GetTicksToRecovery() <= kMaxTicksToRecovery &&
+           subject_velocity_units_per_second >= 0.0 &&
+           subject_angle_volatility_per_second >= 0.0;
+  }
+
+  double GetPairInfectionProbability() const {
+    return 1.0 - (1.0 - infection_probability) * (1.0 - infection_probability);
+  }
+
+  Tick GetTicksToSymptoms() const {
+    return std::lround(days_to_symptoms * kTicksPerDay);
+  }
+
+  Tick GetTicksToRecovery() const {
+    return std::lround((days_to_symptoms + days_symptoms_to_recovery) *
+                       kTicksPerDay);
+  }
+
+private:
+  double* FindParameter(const std::string& name) {
+    if (name == "distance_to_infect")
+      return &distance_to_infect;
+    if (name == "infection_probability")
+      return &infection_probability;
+    if (name == "days_to_symptoms")
+      return &days_to_symptoms;
+    if (name == "days_symptoms_to_recovery")
+      return &days_symptoms_to_recovery;
+    if (name == "subject_velocity_units_per_second")
+      return &subject_velocity_units_per_second;
+    if (name == "subject_angle_volatility_per_second")
+      return &subject_angle_volatility_per_second;
+    return nullptr;
+  }
+};
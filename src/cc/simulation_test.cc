@@ -0,0 +1,447 @@
+#include "simulation.h"
+#include "allocation_counter.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <map>
+#include <set>
+
+TEST(SimulationTest, SteadyStateUpdateDoesNotAllocate) {
+  Simulation simulation;
+  simulation.Init(5000);
+  // Let scratch arenas, pools and per-tick buffers reach their peak size. The
+  // measured ticks include a reorder.
+  for (int i = 0; i < kTicksPerReorder - 24; ++i) {
+    simulation.Update(1);
+  }
+  const int64_t allocations_before = GetAllocationCount();
+  for (int i = 0; i < 48; ++i) {
+    simulation.Update(1);
+    simulation.ComputeInfectionStateHistogram();
+  }
+  EXPECT_EQ(GetAllocationCount(), allocations_before);
+}
+
+TEST(SimulationTest, InitFromDensityFollowsRaster) {
+  // All weight in the right half, three times as much at the top.
+  const DensityRaster density(2, 2, {0.0, 1.0, 0.0, 3.0});
+  Simulation simulation;
+  simulation.InitFromDensity(density, 10000);
+  int num_top = 0;
+  for (const Subject& subject : simulation.GetSubjects()) {
+    ASSERT_GE(subject.GetPosition()[0], 0.5);
+    num_top += subject.GetPosition()[1] >= 0.5;
+  }
+  EXPECT_NEAR(num_top, 7500, 200);
+}
+
+TEST(SimulationTest, InitDoesNotDependOnThreadCount) {
+  // Several batches, so that they are spread over the threads.
+  constexpr int kSubjectCount = 4 * kSubjectsPerInitBatch + 1000;
+  GetRandomEngine().seed(5);
+  Simulation serial(SimulationConfig(), /*worker_count=*/0);
+  serial.Init(kSubjectCount);
+  GetRandomEngine().seed(5);
+  Simulation parallel(SimulationConfig(), /*worker_count=*/3);
+  parallel.Init(kSubjectCount);
+
+  ASSERT_EQ(parallel.GetSubjects().size(), kSubjectCount);
+  for (SubjectIndex i = 0; i < kSubjectCount; ++i) {
+    ASSERT_EQ(parallel.GetSubjects()[i].GetPosition(),
+              serial.GetSubjects()[i].GetPosition())
+        << "subject " << i;
+    ASSERT_EQ(parallel.GetSubjectId(i), serial.GetSubjectId(i));
+  }
+  EXPECT_EQ(parallel.ComputeInfectionStateHistogram(),
+            serial.ComputeInfectionStateHistogram());
+}
+
+TEST(SimulationTest, InitFromFileRestoresPopulation) {
+  const std::string path = testing::TempDir() + "simulation_test.bin";
+  std::vector<Eigen::Vector2d> positions;
+  InfectionStateHistogram histogram;
+  {
+    Simulation simulation;
+    ASSERT_TRUE(simulation.MapSubjectsToFile(path));
+    simulation.Init(3000);
+    for (const Subject& subject : simulation.GetSubjects()) {
+      positions.push_back(subject.GetPosition());
+    }
+    histogram = simulation.ComputeInfectionStateHistogram();
+  }
+
+  Simulation simulation;
+  ASSERT_TRUE(simulation.InitFromFile(path));
+  ASSERT_EQ(simulation.GetSubjects().size(), positions.size());
+  for (int i = 0; i < positions.size(); ++i) {
+    ASSERT_EQ(simulation.GetSubjects()[i].GetPosition(), positions[i]);
+  }
+  EXPECT_EQ(simulation.ComputeInfectionStateHistogram(), histogram);
+  for (int i = 0; i < 10; ++i) {
+    simulation.Update(1);
+  }
+
+  // Running the simulation leaves the file untouched.
+  Simulation reloaded;
+  ASSERT_TRUE(reloaded.InitFromFile(path));
+  EXPECT_EQ(reloaded.GetSubjects()[0].GetPosition(), positions[0]);
+  std::remove(path.c_str());
+}
+
+TEST(SimulationTest, UsesConfiguredParameters) {
+  SimulationConfig config;
+  config.distance_to_infect = 0.01;
+  config.infection_probability = 0.0;
+  config.days_to_symptoms = 1;
+  config.days_symptoms_to_recovery = 1;
+  Simulation simulation(config);
+  simulation.Init(1000);
+  for (int i = 0; i < 2 * kTicksPerDay; ++i) {
+    EXPECT_EQ(simulation.ComputeInfectionStateHistogram()[static_cast<int>(
+                  InfectionState::kRecovered)],
+              0);
+    simulation.Update(1);
+  }
+  const InfectionStateHistogram histogram =
+      simulation.ComputeInfectionStateHistogram();
+  EXPECT_EQ(histogram[static_cast<int>(InfectionState::kUninfected)], 999);
+  EXPECT_EQ(histogram[static_cast<int>(InfectionState::kRecovered)], 1);
+}
+
+TEST(SimulationTest, AppliesPublishedConfigAtNextUpdate) {
+  Simulation simulation;
+  simulation.Init(1000);
+  const double cell_size = simulation.GetCellGrid().GetCellSize();
+  SimulationConfig config = simulation.GetConfig();
+  config.distance_to_infect = 2.0 * cell_size;
+  EXPECT_EQ(simulation.PublishConfig(config), 1u);
+  EXPECT_EQ(simulation.GetConfigVersion(), 0u);
+  EXPECT_EQ(simulation.GetConfig().distance_to_infect, kDistanceToInfect);
+
+  simulation.Update(1);
+  EXPECT_EQ(simulation.GetConfigVersion(), 1u);
+  EXPECT_EQ(simulation.GetConfig().distance_to_infect, 2.0 * cell_size);
+  // Cells grew with the infection distance, and every subject is binned.
+  const CellGrid<SubjectIndex>& grid = simulation.GetCellGrid();
+  EXPECT_GE(grid.GetCellSize(), 2.0 * cell_size);
+  int binned = 0;
+  for (int cell_id = 0; cell_id < grid.GetCellCount(); ++cell_id) {
+    binned += grid.GetCell(cell_id).size();
+  }
+  EXPECT_EQ(binned, 1000);
+}
+
+TEST(SimulationTest, SpatialQueriesMatchFullScan) {
+  Simulation simulation;
+  simulation.Init(20000);
+  const SubjectStore& subjects = simulation.GetSubjects();
+
+  // A circle that wraps around a corner.
+  const Eigen::Vector2d center(0.02, 0.98);
+  const double radius = 0.05;
+  std::vector<SubjectIndex> expected;
+  for (SubjectIndex i = 0; i < subjects.size(); ++i) {
+    Eigen::Vector2d offset = subjects[i].GetPosition() - center;
+    offset[0] -= std::round(offset[0]);
+    offset[1] -= std::round(offset[1]);
+    if (offset.norm() <= radius)
+      expected.push_back(i);
+  }
+  std::vector<SubjectIndex> indices;
+  simulation.GetSubjectsInRadius(center, radius, &indices);
+  std::sort(indices.begin(), indices.end());
+  EXPECT_EQ(indices, expected);
+  const InfectionStateHistogram counts =
+      simulation.CountSubjectsInRadius(center, radius);
+  EXPECT_EQ(std::accumulate(counts.begin(), counts.end(), int64_t{0}),
+            expected.size());
+
+  // A rectangle that wraps around the left edge.
+  expected.clear();
+  for (SubjectIndex i = 0; i < subjects.size(); ++i) {
+    const Eigen::Vector2d position = subjects[i].GetPosition();
+    if ((position[0] <= 0.05 || position[0] >= 0.95) && position[1] >= 0.4 &&
+        position[1] <= 0.5) {
+      expected.push_back(i);
+    }
+  }
+  simulation.GetSubjectsInRect(Eigen::Vector2d(-0.05, 0.4),
+                               Eigen::Vector2d(0.05, 0.5), &indices);
+  std::sort(indices.begin(), indices.end());
+  EXPECT_EQ(indices, expected);
+}
+
+TEST(SimulationTest, RegionStatisticsFollowUpdates) {
+  Simulation simulation;
+  simulation.Init(2000);
+  simulation.EnableRegionStatistics();
+  for (int i = 0; i < 3; ++i) {
+    simulation.Infect(i * 100);
+  }
+  for (int i = 0; i < 50; ++i) {
+    simulation.Update(1);
+  }
+  EXPECT_EQ(simulation.GetRegionStatistics().CountInRect(
+                Eigen::Vector2d(0.0, 0.0), Eigen::Vector2d(1.0, 1.0)),
+            simulation.ComputeInfectionStateHistogram());
+}
+
+TEST(SimulationTest, CountPyramidFollowsUpdates) {
+  SimulationConfig config;
+  config.days_to_symptoms = 1;
+  config.days_symptoms_to_recovery = 1;
+  Simulation simulation(config);
+  simulation.Init(2000);
+  simulation.EnableCountPyramid();
+  for (int i = 0; i < 3; ++i) {
+    simulation.Infect(i * 100);
+  }
+  for (int i = 0; i < 60; ++i) {
+    simulation.Update(1);
+  }
+  simulation.RemoveSubject(7);
+  simulation.AddSubject(Subject(Eigen::Vector2d(0.5, 0.5)));
+
+  const CountPyramid& pyramid = simulation.GetCountPyramid();
+  CountPyramid expected(simulation.GetCellGrid().GetResolution(),
+                        simulation.GetCellGrid().GetCellSize());
+  expected.Build(simulation.GetCellGrid(), simulation.GetSubjects());
+  const int finest_level = pyramid.GetLevelCount() - 1;
+  std::vector<InfectionStateHistogram> tile;
+  std::vector<InfectionStateHistogram> expected_tile;
+  pyramid.GetTile(0, 0, 0, finest_level, &tile);
+  expected.GetTile(0, 0, 0, finest_level, &expected_tile);
+  EXPECT_EQ(tile, expected_tile);
+  EXPECT_EQ(pyramid.GetNode(0, 0, 0),
+            simulation.ComputeInfectionStateHistogram());
+}
+
+namespace {
+
+// Expects every subject in the grid cell of its position, with matching
+// back-references, and the grid's marks to count the contagious subjects.
+void ExpectGridConsistent(const Simulation& simulation) {
+  const CellGrid<SubjectIndex>& grid = simulation.GetCellGrid();
+  const SubjectStore& subjects = simulation.GetSubjects();
+  size_t entry_count = 0;
+  for (int cell_id = 0; cell_id < grid.GetCellCount(); ++cell_id) {
+    int contagious_count = 0;
+    for (const SubjectIndex index : grid.GetCell(cell_id)) {
+      ASSERT_LT(index, subjects.size());
+      EXPECT_EQ(grid.GetCellIdOf(index), cell_id);
+      const Eigen::Vector2d position = subjects[index].GetPosition();
+      const int x = position[0] / grid.GetCellSize();
+      const int y = position[1] / grid.GetCellSize();
+      EXPECT_EQ(y * grid.GetResolution() + x, cell_id);
+      contagious_count += subjects[index].IsContagious();
+      ++entry_count;
+    }
+    EXPECT_EQ(grid.GetMarkCount(cell_id), contagious_count);
+  }
+  EXPECT_EQ(entry_count, subjects.size());
+}
+
+bool IsInHilbertOrder(const Simulation& simulation) {
+  const SubjectStore& subjects = simulation.GetSubjects();
+  // The curve order that ReorderSubjects picks for the population.
+  const int order = std::clamp(
+      static_cast<int>(std::log2(std::max<size_t>(subjects.size(), 1)) / 2),
+      1, 15);
+  for (size_t i = 1; i < subjects.size(); ++i) {
+    if (HilbertIndexFromPosition(subjects[i].GetPosition(), order) <
+        HilbertIndexFromPosition(subjects[i - 1].GetPosition(), order)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+TEST(SimulationTest, ReorderKeepsGridAndIdsConsistent) {
+  Simulation simulation;
+  simulation.Init(3000);
+  for (int i = 0; i < 20; ++i) {
+    simulation.Infect(i * 150);
+  }
+  for (int i = 0; i < 30; ++i) {
+    simulation.Update(1);
+  }
+  std::map<SubjectIndex, std::pair<Eigen::Vector2d, InfectionState>> by_id;
+  for (SubjectIndex i = 0; i < simulation.GetSubjects().size(); ++i) {
+    const Subject& subject = simulation.GetSubjects()[i];
+    by_id[simulation.GetSubjectId(i)] = {subject.GetPosition(),
+                                         subject.GetInfectionState()};
+  }
+
+  simulation.ReorderSubjects();
+
+  EXPECT_TRUE(IsInHilbertOrder(simulation));
+  ExpectGridConsistent(simulation);
+  ASSERT_EQ(simulation.GetSubjects().size(), by_id.size());
+  std::set<SubjectIndex> ids;
+  for (SubjectIndex i = 0; i < simulation.GetSubjects().size(); ++i) {
+    const Subject& subject = simulation.GetSubjects()[i];
+    const SubjectIndex id = simulation.GetSubjectId(i);
+    ids.insert(id);
+    ASSERT_EQ(by_id.count(id), 1u);
+    EXPECT_EQ(subject.GetPosition(), by_id[id].first);
+    EXPECT_EQ(subject.GetInfectionState(), by_id[id].second);
+  }
+  EXPECT_EQ(ids.size(), by_id.size());
+}
+
+TEST(SimulationTest, ReordersOncePerSimulatedWeek) {
+  Simulation simulation;
+  simulation.Init(3000);
+  // Twelve-tick steps reach the week with the 14th step.
+  constexpr Tick kStep = 12;
+  static_assert(kTicksPerReorder % kStep == 0, "Steps must hit the week.");
+  for (int i = 0; i + 1 < kTicksPerReorder / kStep; ++i) {
+    simulation.Update(kStep);
+  }
+  EXPECT_FALSE(IsInHilbertOrder(simulation));
+  simulation.Update(kStep);
+  EXPECT_TRUE(IsInHilbertOrder(simulation));
+  ExpectGridConsistent(simulation);
+}
+
+namespace {
+
+// Expects ComputeActivity, which reads tracked counts, to agree with a scan of
+// all subjects. After a removal, the tracked time to the next transition may
+// be shorter than the scanned one.
+void ExpectActivityMatchesScan(const Simulation& simulation,
+                               bool after_removal) {
+  bool any_infected = false;
+  bool any_susceptible = false;
+  bool any_pending = false;
+  Tick time_to_next_transition = std::numeric_limits<Tick>::max();
+  for (const Subject& subject : simulation.GetSubjects()) {
+    any_susceptible |= subject.IsSusceptible();
+    const std::optional<Tick> ticks = subject.GetTicksToNextTransition();
+    if (!ticks)
+      continue;
+    any_infected = true;
+    any_pending |= subject.GetInfectionState() == InfectionState::kUninfected;
+    time_to_next_transition = std::min(time_to_next_transition, *ticks);
+  }
+  const Simulation::Activity activity = simulation.ComputeActivity();
+  EXPECT_EQ(activity.any_infected, any_infected);
+  EXPECT_EQ(activity.any_susceptible, any_susceptible);
+  if (any_pending) {
+    EXPECT_TRUE(activity.any_exposed);
+  }
+  if (after_removal) {
+    EXPECT_LE(activity.time_to_next_transition, time_to_next_transition);
+  } else {
+    EXPECT_EQ(activity.time_to_next_transition, time_to_next_transition);
+  }
+}
+
+}  // namespace
+
+TEST(SimulationTest, ActivityFollowsUpdates) {
+  SimulationConfig config;
+  config.days_to_symptoms = 1;
+  config.days_symptoms_to_recovery = 2;
+  Simulation simulation(config);
+  simulation.Init(3000);
+  ExpectActivityMatchesScan(simulation, false);
+  for (int i = 0; i < 150; ++i) {
+    if (i % 10 == 0) {
+      simulation.RemoveSubject(i);
+      Subject subject(Eigen::Vector2d(0.5, 0.5));
+      subject.MaybeInfect(config);
+      simulation.AddSubject(subject);
+      simulation.Infect(i * 7);
+      ExpectActivityMatchesScan(simulation, true);
+    }
+    // Steps of varying length.
+    simulation.Update(1 + i % 5);
+    ExpectActivityMatchesScan(simulation, false);
+  }
+}
+
+namespace {
+
+// Share of subjects that were ever infected after |days| of one-tick steps,
+// starting from a few infections spread over the domain.
+double ComputeAttackRate(int infection_check_interval, unsigned seed) {
+  GetRandomEngine().seed(seed);
+  SimulationConfig config;
+  config.days_to_symptoms = 2;
+  config.days_symptoms_to_recovery = 4;
+  config.infection_probability = 0.3;
+  config.subject_velocity_units_per_second *= 0.5;
+  Simulation simulation(config);
+  simulation.SetInfectionCheckInterval(infection_check_interval);
+  constexpr int kSubjectCount = 5000;
+  simulation.Init(kSubjectCount);
+  for (int i = 1; i < 10; ++i) {
+    simulation.Infect(i * kSubjectCount / 10);
+  }
+  for (int tick = 0; tick < 20 * kTicksPerDay; ++tick) {
+    simulation.Update(1);
+  }
+  const InfectionStateHistogram histogram =
+      simulation.ComputeInfectionStateHistogram();
+  return 1.0 -
+         static_cast<double>(
+             histogram[static_cast<int>(InfectionState::kUninfected)]) /
+             kSubjectCount;
+}
+
+}  // namespace
+
+TEST(SimulationTest, InfectionCheckIntervalCountsSimulatedTime) {
+  // Pairs of a contagious and a susceptible subject that stand still in the
+  // same spot, far apart from each other. The susceptible one should catch
+  // the infection with 1 - (1 - p)^ticks however the ticks are split into
+  // steps and checks.
+  SimulationConfig config;
+  config.subject_velocity_units_per_second = 0.0;
+  config.subject_angle_volatility_per_second = 0.0;
+  constexpr int kPairsPerAxis = 40;
+  constexpr Tick kDuration = 24;
+  const double expected =
+      1.0 - std::pow(1.0 - config.GetPairInfectionProbability(), kDuration);
+  for (const int interval : {1, 3}) {
+    for (const Tick dt : {1, 2, 3}) {
+      Simulation simulation(config);
+      simulation.SetInfectionCheckInterval(interval);
+      simulation.InitEmpty(2 * kPairsPerAxis * kPairsPerAxis);
+      for (int i = 0; i < kPairsPerAxis * kPairsPerAxis; ++i) {
+        const Eigen::Vector2d position(
+            (i % kPairsPerAxis + 0.5) / kPairsPerAxis,
+            (i / kPairsPerAxis + 0.5) / kPairsPerAxis);
+        simulation.Infect(simulation.AddSubject(Subject(position)));
+        simulation.AddSubject(Subject(position));
+      }
+      for (Tick time = 0; time < kDuration; time += dt) {
+        simulation.Update(dt);
+      }
+      // Including infections from the last check, which only turn
+      // contagious with the next Update.
+      int susceptible = 0;
+      for (const Subject& subject : simulation.GetSubjects()) {
+        susceptible += subject.IsSusceptible();
+      }
+      EXPECT_NEAR(1.0 - static_cast<double>(susceptible) /
+                            (kPairsPerAxis * kPairsPerAxis),
+                  expected, 0.05)
+          << "interval " << interval << ", dt " << dt;
+    }
+  }
+}
+
+TEST(SimulationTest, InfectionCheckIntervalKeepsAttackRate) {
+  constexpr int kSeedCount = 6;
+  double attack_rate = 0.0;
+  double sparse_attack_rate = 0.0;
+  for (unsigned seed = 1; seed <= kSeedCount; ++seed) {
+    attack_rate += ComputeAttackRate(1, seed) / kSeedCount;
+    sparse_attack_rate += ComputeAttackRate(2, seed) / kSeedCount;
+  }
+  EXPECT_GT(attack_rate, 0.2);
+  EXPECT_NEAR(sparse_attack_rate, attack_rate, 0.12);
+}
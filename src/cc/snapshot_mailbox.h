@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Hands the latest of a series of values from any number of publishing
+// threads to one consuming thread without locks. Publish() swaps a fresh
+// immutable snapshot into a single atomic slot, and Take() swaps it out, so
+// every snapshot is owned by exactly one side at a time and is freed by
+// whoever holds it last. A snapshot that is replaced before the consumer gets
+// to it is dropped, so the consumer only ever sees whole values, and with a
+// single publisher it sees them in publication order.
+//
+// Only Publish() allocates; checking an empty mailbox is a single atomic
+// load.
+template <typename T>
+class SnapshotMailbox {
+public:
+  SnapshotMailbox() = default;
+  ~SnapshotMailbox() { delete slot_.exchange(nullptr); }
+
+  SnapshotMailbox(const SnapshotMailbox&) = delete;
+  SnapshotMailbox& operator=(const SnapshotMailbox&) = delete;
+
+  // Makes |value| the next value for Take(), replacing any value that has not
+  // been taken yet. Returns its version; versions start at 1 and increase with
+  // every publication. Thread-safe.
+  uint64_t Publish(const T& value) {
+    auto snapshot = std::make_unique<Snapshot>(Snapshot{value, 0});
+    snapshot->version = next_version_.fetch_add(1) + 1;
+    const uint64_t version = snapshot->version;
+    delete slot_.exchange(snapshot.release(), std::memory_order_acq_rel);
+    return version;
+  }
+
+  // Moves the latest published value into |value| and its version into
+  // |version|, if one arrived since the last call. Returns whether it did.
+  bool Take(T* value, uint64_t* version) {
+    if (!slot_.load(std::memory_order_relaxed))
+      return false;
+    std::unique_ptr<Snapshot> snapshot(
+        slot_.exchange(nullptr, std::memory_order_acquire));
+    if (!snapshot)
+      return false;
+    *value = std::move(snapshot->value);
+    *version = snapshot->version;
+    return true;
+  }
+
+private:
+  struct Snapshot {
+    T value;
+    uint64_t version;
+  };
+
+  std::atomic<Snapshot*> slot_{nullptr};
+  std::atomic<uint64_t> next_version_{0};
+};
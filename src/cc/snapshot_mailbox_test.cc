@@ -0,0 +1,42 @@
+#include "snapshot_mailbox.h"
+#include "gtest/gtest.h"
+#include <thread>
+
+TEST(SnapshotMailboxTest, TakesLatestValueOnce) {
+  SnapshotMailbox<int> mailbox;
+  int value = 0;
+  uint64_t version = 0;
+  EXPECT_FALSE(mailbox.Take(&value, &version));
+  EXPECT_EQ(mailbox.Publish(1), 1u);
+  EXPECT_EQ(mailbox.Publish(2), 2u);
+  ASSERT_TRUE(mailbox.Take(&value, &version));
+  EXPECT_EQ(value, 2);
+  EXPECT_EQ(version, 2u);
+  EXPECT_FALSE(mailbox.Take(&value, &version));
+}
+
+TEST(SnapshotMailboxTest, ConsumerSeesWholeValuesInOrder) {
+  struct Pair {
+    int64_t a;
+    int64_t b;
+  };
+  constexpr int64_t kNumValues = 100000;
+  SnapshotMailbox<Pair> mailbox;
+  std::thread publisher([&] {
+    for (int64_t i = 1; i <= kNumValues; ++i) {
+      mailbox.Publish(Pair{i, -i});
+    }
+  });
+  Pair value{0, 0};
+  uint64_t version = 0;
+  int64_t last = 0;
+  while (last < kNumValues) {
+    if (!mailbox.Take(&value, &version))
+      continue;
+    ASSERT_EQ(value.b, -value.a);
+    ASSERT_GT(value.a, last);
+    ASSERT_EQ(version, static_cast<uint64_t>(value.a));
+    last = value.a;
+  }
+  publisher.join();
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+// Distance of cell (x, y) along a Hilbert curve that fills a 2^order x 2^order
+// grid. Cells that are close along the curve are close in space, which makes
+// the curve a good sort key for memory layouts.
+inline uint64_t HilbertIndex(uint32_t x, uint32_t y, int order) {
+  const uint32_t n = uint32_t{1} << order;
+  uint64_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    const uint32_t rx = (x & s) > 0;
+    const uint32_t ry = (y & s) > 0;
+    d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so that the sub-curve has the canonical
+    // orientation.
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+// Hilbert index of a position in the unit square, quantized to a
+// 2^order x 2^order grid.
+inline uint64_t HilbertIndexFromPosition(const Eigen::Vector2d &position,
+                                         int order = 16) {
+  const uint32_t n = uint32_t{1} << order;
+  const auto quantize = [n](double value) {
+    return static_cast<uint32_t>(
+        std::clamp(value * n, 0.0, static_cast<double>(n - 1)));
+  };
+  return HilbertIndex(quantize(position[0]), quantize(position[1]), order);
+}
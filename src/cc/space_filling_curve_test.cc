@@ -0,0 +1,41 @@
+#include "space_filling_curve.h"
+#include "gtest/gtest.h"
+#include <cstdlib>
+#include <vector>
+
+TEST(SpaceFillingCurveTest, HilbertIndexIsBijective) {
+  constexpr int kOrder = 3;
+  constexpr int kSize = 1 << kOrder;
+  std::vector<int> seen(kSize * kSize);
+  for (int y = 0; y < kSize; ++y) {
+    for (int x = 0; x < kSize; ++x) {
+      const uint64_t d = HilbertIndex(x, y, kOrder);
+      ASSERT_LT(d, seen.size());
+      ++seen[d];
+    }
+  }
+  for (int count : seen) {
+    EXPECT_EQ(count, 1);
+  }
+}
+
+TEST(SpaceFillingCurveTest, ConsecutiveIndicesAreAdjacentCells) {
+  constexpr int kOrder = 4;
+  constexpr int kSize = 1 << kOrder;
+  std::vector<Eigen::Vector2i> cells(kSize * kSize);
+  for (int y = 0; y < kSize; ++y) {
+    for (int x = 0; x < kSize; ++x) {
+      cells[HilbertIndex(x, y, kOrder)] = Eigen::Vector2i(x, y);
+    }
+  }
+  for (int d = 1; d < cells.size(); ++d) {
+    const Eigen::Vector2i step = cells[d] - cells[d - 1];
+    EXPECT_EQ(std::abs(step[0]) + std::abs(step[1]), 1) << "at " << d;
+  }
+}
+
+TEST(SpaceFillingCurveTest, HilbertIndexFromPositionClampsToUnitSquare) {
+  EXPECT_EQ(HilbertIndexFromPosition(Eigen::Vector2d(0.0, 0.0), 2), 0);
+  EXPECT_EQ(HilbertIndexFromPosition(Eigen::Vector2d(1.0, 0.0), 2),
+            HilbertIndex(3, 0, 2));
+}
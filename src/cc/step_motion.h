@@ -0,0 +1,111 @@
+#pragma once
+#include "common.h"
+#include "simulation_config.h"
+#include <algorithm>
+#include <cmath>
+
+// Subject::Update moves a subject by a random walk: every tick it turns by an
+// angle drawn uniformly from +-volatility / 2 and then moves in its new
+// heading by a distance drawn from an exponential distribution.
+//
+// Over a step of several ticks, the sum of these moves is close to Gaussian,
+// so a long step can draw it at once instead of tick by tick. StepMotion holds
+// the parameters of that draw for |ticks| ticks, in the frame of the heading
+// at the start of the step:
+//  - The total turn is wrapped normal with deviation |turn_stddev|, which
+//    gives it the same mean direction cosine as the sum of the turns.
+//  - The move along the heading is |along_mean|, plus |along_per_cos_turn|
+//    times the deviation of cos(turn) from its mean, plus noise with
+//    deviation |along_stddev|.
+//  - The move across the heading is |across_per_sin_turn| times sin(turn),
+//    plus noise with deviation |across_stddev|.
+// The dependence on the turn carries over that the last ticks of a walk
+// move in about its final heading. Means, variances and the covariances with
+// cos(turn) and sin(turn) are those of the tick-by-tick walk. They are
+// computed once per step length and shared by all subjects.
+struct StepMotion {
+  StepMotion(Tick ticks, const SimulationConfig& config) : ticks(ticks) {
+    // Mean and second moment of the distance per tick.
+    const double mean = 2.5 * config.subject_velocity_units_per_second *
+                        kSecondsPerTick;
+    const double second_moment = 2.0 * mean * mean;
+    // Turns per tick are uniform on [-b, b], with E[cos(turn)] = rho and
+    // E[cos(2 turn)] = rho2.
+    const double b =
+        0.5 * config.subject_angle_volatility_per_second * kSecondsPerTick;
+    const double rho = b > 0.0 ? std::sin(b) / b : 1.0;
+    const double rho2 = b > 0.0 ? std::sin(2.0 * b) / (2.0 * b) : 1.0;
+
+    // With z_l the direction in tick l relative to the initial heading, as a
+    // complex number, and w the direction after the step, the move is
+    // D = sum_l s_l z_l, where for k < l
+    //   E[z_l] = rho^l,  E[z_l^2] = rho2^l,
+    //   E[z_k conj(z_l)] = rho^(l - k),  E[z_k z_l] = rho2^k rho^(l - k),
+    //   E[z_l conj(w)] = rho^(n - l),  E[z_l w] = rho2^l rho^(n - l).
+    // All expectations are real in this frame. Sums over k < l and k <= l
+    // are accumulated per l.
+    double sum_rho = 0.0;
+    double squared_norm = 0.0;  // E[|D|^2]
+    double square = 0.0;        // E[D^2]
+    double times_conj_w = 0.0;  // E[D conj(w)]
+    double times_w = 0.0;       // E[D w]
+    double earlier_conj = 0.0;  // sum_{k < l} rho^(l - k)
+    double earlier = 0.0;       // sum_{k < l} rho2^k rho^(l - k)
+    double rho_power = 1.0;
+    double rho2_power = 1.0;
+    for (Tick l = 1; l <= ticks; ++l) {
+      times_conj_w += mean * rho_power;
+      rho_power *= rho;
+      rho2_power *= rho2;
+      sum_rho += rho_power;
+      squared_norm += second_moment + 2.0 * mean * mean * earlier_conj;
+      square += second_moment * rho2_power + 2.0 * mean * mean * earlier;
+      earlier_conj = rho * (earlier_conj + 1.0);
+      earlier = rho * (earlier + rho2_power);
+    }
+    // earlier / rho = sum_{k <= n} rho2^k rho^(n - k), unless rho = 0.
+    times_w = mean * (rho != 0.0 ? earlier / rho : rho2_power);
+    along_mean = mean * sum_rho;
+    const double covariance = squared_norm - along_mean * along_mean;
+    const double pseudo_covariance = square - along_mean * along_mean;
+    const double along_variance = 0.5 * (covariance + pseudo_covariance);
+    const double across_variance = 0.5 * (covariance - pseudo_covariance);
+
+    // Wrapped normal turn with E[cos(turn)] = rho^n; a full turn of
+    // deviation makes it uniform.
+    const double turn_variance =
+        rho >= 1.0 ? 0.0
+        : rho > 0.0 ? std::min(-2.0 * ticks * std::log(rho), 100.0)
+                    : 100.0;
+    turn_stddev = std::sqrt(turn_variance);
+    const double cos_mean = std::exp(-0.5 * turn_variance);
+    const double cos_2_mean = std::exp(-2.0 * turn_variance);
+    const double cos_variance = 0.5 * (1.0 + cos_2_mean) - cos_mean * cos_mean;
+    const double sin_variance = 0.5 * (1.0 - cos_2_mean);
+    turn_cos_mean = cos_mean;
+
+    // Regressions on cos(turn) and sin(turn); by symmetry, the move along
+    // the heading does not depend on sin(turn), nor the move across on
+    // cos(turn).
+    const double along_cos_covariance =
+        0.5 * (times_conj_w + times_w) - along_mean * cos_mean;
+    const double across_sin_covariance = 0.5 * (times_conj_w - times_w);
+    along_per_cos_turn =
+        cos_variance > 1e-12 ? along_cos_covariance / cos_variance : 0.0;
+    across_per_sin_turn =
+        sin_variance > 1e-12 ? across_sin_covariance / sin_variance : 0.0;
+    along_stddev = std::sqrt(std::max(
+        along_variance - along_per_cos_turn * along_cos_covariance, 0.0));
+    across_stddev = std::sqrt(std::max(
+        across_variance - across_per_sin_turn * across_sin_covariance, 0.0));
+  }
+
+  Tick ticks;
+  double turn_stddev;
+  double turn_cos_mean;
+  double along_mean;
+  double along_per_cos_turn;
+  double along_stddev;
+  double across_per_sin_turn;
+  double across_stddev;
+};
@@ -0,0 +1,39 @@
+#include "step_motion.h"
+#include "gtest/gtest.h"
+#include <cmath>
+
+TEST(StepMotionTest, MatchesStraightWalkWithoutTurns) {
+  SimulationConfig config;
+  config.subject_angle_volatility_per_second = 0.0;
+  const double mean =
+      2.5 * config.subject_velocity_units_per_second * kSecondsPerTick;
+  const StepMotion motion(12, config);
+  EXPECT_EQ(motion.turn_stddev, 0.0);
+  // A sum of 12 exponential distances.
+  EXPECT_NEAR(motion.along_mean, 12 * mean, 1e-12);
+  EXPECT_NEAR(motion.along_stddev, std::sqrt(12.0) * mean, 1e-12);
+  EXPECT_EQ(motion.across_per_sin_turn, 0.0);
+  EXPECT_EQ(motion.across_stddev, 0.0);
+}
+
+TEST(StepMotionTest, KeepsMeanSquaredDistanceOfOneTick) {
+  const SimulationConfig config;
+  const double mean =
+      2.5 * config.subject_velocity_units_per_second * kSecondsPerTick;
+  const StepMotion motion(1, config);
+  // E[s^2] for an exponential distance s, however the tick turns.
+  const double turn_cos_variance =
+      0.5 * (1.0 + std::pow(motion.turn_cos_mean, 4)) -
+      motion.turn_cos_mean * motion.turn_cos_mean;
+  const double turn_sin_variance =
+      0.5 * (1.0 - std::pow(motion.turn_cos_mean, 4));
+  const double squared_distance =
+      motion.along_mean * motion.along_mean +
+      motion.along_per_cos_turn * motion.along_per_cos_turn *
+          turn_cos_variance +
+      motion.along_stddev * motion.along_stddev +
+      motion.across_per_sin_turn * motion.across_per_sin_turn *
+          turn_sin_variance +
+      motion.across_stddev * motion.across_stddev;
+  EXPECT_NEAR(squared_distance, 2.0 * mean * mean, 1e-12);
+}
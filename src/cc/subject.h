@@ -1,102 +1,208 @@
 #pragma once
 #include "common.h"
+#include "gtest/gtest_prod.h"
+#include "simulation_config.h"
+#include "step_motion.h"
 #include <Eigen/Core>
+#include <cmath>
 #include <optional>
 
-constexpr double kDaysToSymptoms = 14;
-constexpr double kDaysSymptomsToRecovery = 10;
-constexpr double kSubjectVelocityUnitsPerSecond = 3e-7;
-constexpr double kSubjectAngleVolatilityPerSecond = 1e-3;
-
-struct Infection {
-  Time symptom_start_time;
-  Time recovery_time;
-};
-
+// Subjects are packed into 12 bytes so that populations of 100M fit into
+// memory:
+// - The position is a pair of 32-bit fixed-point fractions of the unit
+//   square. Moves wrap around the domain through unsigned overflow.
+// - The heading is quantized to 1/65536 of a full turn.
+// - The infection state takes 2 bits and the ticks left until its next
+//   transition take 14 bits.
 class Subject {
 public:
-  explicit Subject(const Eigen::Vector2d &position) : position_(position) {
-    angle_radians_ = GenerateNormalizedUniformRandomNumber() * 2.0 * M_PI;
-    velocity_per_second_ = kSubjectVelocityUnitsPerSecond *
-                           (1.2 - GenerateNormalizedUniformRandomNumber() * 0.4);
+  explicit Subject(const Eigen::Vector2d &position)
+      : Subject(position,
+                GenerateNormalizedUniformRandomNumber() * 2.0 * M_PI) {}
+
+  // Starts out heading in direction |angle_radians|.
+  Subject(const Eigen::Vector2d &position, double angle_radians)
+      : x_(ToFixedPoint(position[0])),
+        y_(ToFixedPoint(position[1])),
+        heading_(ToHeading(angle_radians)),
+        infection_state_(static_cast<uint16_t>(InfectionState::kUninfected)),
+        ticks_to_transition_(0) {}
+
+  Eigen::Vector2d GetPosition() const {
+    return Eigen::Vector2d(x_ / kFixedPointScale, y_ / kFixedPointScale);
+  }
+  InfectionState GetInfectionState() const {
+    return static_cast<InfectionState>(infection_state_);
   }
-  const Eigen::Vector2d &GetPosition() const { return position_; }
-  InfectionState GetInfectionState() const { return infection_state_; }
-  bool IsContagious() const {
-    return infection_state_ == InfectionState::kInfectedWithoutSymptoms ||
-           infection_state_ == InfectionState::kInfectedWithSymptoms;
+  bool IsSusceptible() const {
+    return GetInfectionState() == InfectionState::kUninfected &&
+           ticks_to_transition_ == 0;
   }
+  bool IsContagious() const { return ::IsContagious(GetInfectionState()); }
 
-  void MaybeInfect(Time time) {
-    if (IsImmune() || infection_)
+  // Infects a susceptible subject. It turns contagious with its next Update.
+  void MaybeInfect(const SimulationConfig& config) {
+    if (!IsSusceptible())
       return;
+    ticks_to_transition_ = config.GetTicksToSymptoms();
+  }
+
+  // Ticks until the infection state changes next, if it still changes.
+  std::optional<Tick> GetTicksToNextTransition() const {
+    if (ticks_to_transition_ == 0)
+      return std::nullopt;
+    return ticks_to_transition_;
+  }
 
-    infection_ = Infection{
-        .symptom_start_time =
-            time + Hours(static_cast<int>(kDaysToSymptoms * 24)),
-        .recovery_time =
-            time + Hours(static_cast<int>(
-                       (kDaysToSymptoms + kDaysSymptomsToRecovery) * 24)),
-    };
+  // Turns a subject that was never infected into one that has recovered.
+  void SetRecovered() {
+    assert(IsSusceptible());
+    SetInfectionState(InfectionState::kRecovered);
   }
 
   std::string ToString() const {
     std::stringstream ss;
-    ss << "S[pos=(" << position_[0] << ", " << position_[1]
+    const Eigen::Vector2d position = GetPosition();
+    ss << "S[pos=(" << position[0] << ", " << position[1]
        << "), infection_state=" << GetInfectionState() << "]";
     return ss.str();
   }
 
-  void Update(Time time, Duration dt) {
-    const double dt_seconds =
-        std::chrono::duration_cast<std::chrono::seconds>(dt).count();
+  // Advances the infection by |dt| at once. Short steps move tick by tick;
+  // longer ones draw the whole move from the StepMotion for |dt| ticks, so
+  // that they cost no more than a one-tick step and still spread subjects
+  // like the tick-by-tick walk.
+  void Update(Tick dt, const SimulationConfig& config) {
+    if (dt < kMinSampledMoveTicks) {
+      AdvanceInfection(dt, config);
+      MoveTickByTick(dt, config);
+    } else {
+      Update(dt, config, StepMotion(dt, config));
+    }
+  }
 
-    // Update infection state.
-    infection_state_ = ComputeInfectionState(time);
+  // Like Update(dt, config), with |motion| computed once for all subjects.
+  void Update(Tick dt, const SimulationConfig& config,
+              const StepMotion& motion) {
+    assert(motion.ticks == dt);
+    AdvanceInfection(dt, config);
+    if (dt < kMinSampledMoveTicks) {
+      MoveTickByTick(dt, config);
+    } else {
+      SampleMove(motion);
+    }
+  }
 
+private:
+  static constexpr double kFixedPointScale = 4294967296.0;  // 2^32
+  static constexpr int kHeadingSteps = 1 << 16;
+  static constexpr int kTransitionTimerBits = 14;
+  // Below this many ticks, the sum of the moves is too far from Gaussian.
+  static constexpr Tick kMinSampledMoveTicks = 4;
+  static_assert(kMaxTicksToRecovery < (1 << kTransitionTimerBits),
+                "Transition timer too narrow.");
+
+  // Maps |coordinate| onto the unit interval, wrapping around, and returns it
+  // as a fraction of 2^32.
+  static uint32_t ToFixedPoint(double coordinate) {
+    const double fraction = coordinate - std::floor(coordinate);
+    return static_cast<uint64_t>(fraction * kFixedPointScale);
+  }
+
+  // Quantizes |angle_radians|, wrapping around full turns.
+  static uint16_t ToHeading(double angle_radians) {
+    return static_cast<int64_t>(
+        std::lround(angle_radians * kHeadingSteps / (2.0 * M_PI)));
+  }
+
+  // Turns and moves for one tick.
+  void Move(const SimulationConfig& config) {
     // Update angle.
-    angle_radians_ += (GenerateNormalizedUniformRandomNumber() - 0.5) *
-                      kSubjectAngleVolatilityPerSecond * dt_seconds;
+    const double turn_radians =
+        (GenerateNormalizedUniformRandomNumber() - 0.5) *
+        config.subject_angle_volatility_per_second * kSecondsPerTick;
+    heading_ += ToHeading(turn_radians);
     // Determine next direction.
-    const Eigen::Vector2d velocity_direction(std::cos(angle_radians_),
-                                             std::sin(angle_radians_));
+    const double angle_radians = heading_ * 2.0 * M_PI / kHeadingSteps;
+    const Eigen::Vector2d velocity_direction(std::cos(angle_radians),
+                                             std::sin(angle_radians));
     const double velocity_magnitude_per_second =
-        GenerateExponentiallyDistributedRandomNumber(2.0) * kSubjectVelocityUnitsPerSecond * 5.0;
-    //const double velocity_magnitude_per_second = velocity_per_second_;
+        GenerateExponentiallyDistributedRandomNumber(2.0) *
+        config.subject_velocity_units_per_second * 5.0;
     const Eigen::Vector2d velocity_vector_per_second =
         velocity_direction * velocity_magnitude_per_second;
-    position_ += velocity_vector_per_second * dt_seconds;
+    const Eigen::Vector2d displacement =
+        velocity_vector_per_second * kSecondsPerTick;
 
-    // Handle domain boundaries.
-    if (position_[0] > 1.0)
-      position_[0] -= 1.0;
-    if (position_[1] > 1.0)
-      position_[1] -= 1.0;
-    if (position_[0] < 0.0)
-      position_[0] += 1.0;
-    if (position_[1] < 0.0)
-      position_[1] += 1.0;
+    // Domain boundaries are handled by the fixed-point wrap-around.
+    x_ += ToFixedPoint(displacement[0]);
+    y_ += ToFixedPoint(displacement[1]);
   }
 
-private:
-  bool IsImmune() const {
-    return infection_state_ == InfectionState::kRecovered;
+  void MoveTickByTick(Tick dt, const SimulationConfig& config) {
+    for (Tick tick = 0; tick < dt; ++tick) {
+      Move(config);
+    }
   }
 
-  InfectionState ComputeInfectionState(Time time) const {
-    if (!infection_)
-      return InfectionState::kUninfected;
-    if (time < infection_->symptom_start_time)
-      return InfectionState::kInfectedWithoutSymptoms;
-    if (time < infection_->recovery_time)
-      return InfectionState::kInfectedWithSymptoms;
-    return InfectionState::kRecovered;
+  // Turns and moves for a whole step at once.
+  void SampleMove(const StepMotion& motion) {
+    const double turn_radians =
+        motion.turn_stddev * GenerateStandardNormalRandomNumber();
+    const double along =
+        motion.along_mean +
+        motion.along_per_cos_turn *
+            (std::cos(turn_radians) - motion.turn_cos_mean) +
+        motion.along_stddev * GenerateStandardNormalRandomNumber();
+    const double across =
+        motion.across_per_sin_turn * std::sin(turn_radians) +
+        motion.across_stddev * GenerateStandardNormalRandomNumber();
+    const double angle_radians = heading_ * 2.0 * M_PI / kHeadingSteps;
+    const double cos_angle = std::cos(angle_radians);
+    const double sin_angle = std::sin(angle_radians);
+    x_ += ToFixedPoint(along * cos_angle - across * sin_angle);
+    y_ += ToFixedPoint(along * sin_angle + across * cos_angle);
+    heading_ += ToHeading(turn_radians);
   }
 
-  InfectionState infection_state_;
-  std::optional<Infection> infection_;
-  Eigen::Vector2d position_;
-  double velocity_per_second_;
-  double angle_radians_;
+  void SetInfectionState(InfectionState infection_state) {
+    infection_state_ = static_cast<uint16_t>(infection_state);
+  }
+
+  // Counts the transition timer down by |dt|, passing through every
+  // transition that falls into the step.
+  void AdvanceInfection(Tick dt, const SimulationConfig& config) {
+    if (GetInfectionState() == InfectionState::kUninfected) {
+      if (ticks_to_transition_ == 0)
+        return;
+      SetInfectionState(InfectionState::kInfectedWithoutSymptoms);
+    }
+    while (IsContagious()) {
+      if (dt < ticks_to_transition_) {
+        ticks_to_transition_ -= dt;
+        return;
+      }
+      dt -= ticks_to_transition_;
+      if (GetInfectionState() == InfectionState::kInfectedWithoutSymptoms) {
+        SetInfectionState(InfectionState::kInfectedWithSymptoms);
+        ticks_to_transition_ =
+            config.GetTicksToRecovery() - config.GetTicksToSymptoms();
+      } else {
+        SetInfectionState(InfectionState::kRecovered);
+        ticks_to_transition_ = 0;
+      }
+    }
+  }
+
+  FRIEND_TEST(SubjectTest, FixedPointWrapsAround);
+  FRIEND_TEST(SubjectTest, HeadingRoundTrips);
+  FRIEND_TEST(SubjectTest, LongStepsSpreadLikeOneTickSteps);
+
+  uint32_t x_;
+  uint32_t y_;
+  uint16_t heading_;
+  uint16_t infection_state_ : 2;
+  uint16_t ticks_to_transition_ : kTransitionTimerBits;
 };
 
+static_assert(sizeof(Subject) == 12, "Subject is no longer packed.");
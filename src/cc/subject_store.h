@@ -0,0 +1,225 @@
+#pragma once
+#include "subject.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+#ifndef __EMSCRIPTEN__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Contiguous array of subjects with the subset of std::vector's interface
+// that the simulation needs. It lives on the heap unless MapFile() moves it
+// into a memory-mapped file, in which case populations larger than RAM page
+// through the page cache. Simulation keeps subjects sorted along a Hilbert
+// curve and walks them in index order, so those pages stream sequentially
+// and WillNeed() can ask the kernel to read ahead.
+//
+// A file that a mapped store leaves behind holds exactly its subjects, so
+// MapExistingFile() can start later runs from the same population.
+class SubjectStore {
+  static_assert(std::is_trivially_copyable<Subject>::value,
+                "Subjects are relocated with realloc and file remapping.");
+
+public:
+  SubjectStore() = default;
+  ~SubjectStore() { Deallocate(); }
+
+  SubjectStore(const SubjectStore&) = delete;
+  SubjectStore& operator=(const SubjectStore&) = delete;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  Subject& operator[](size_t index) { return data_[index]; }
+  const Subject& operator[](size_t index) const { return data_[index]; }
+  Subject& back() { return data_[size_ - 1]; }
+
+  Subject* begin() { return data_; }
+  Subject* end() { return data_ + size_; }
+  const Subject* begin() const { return data_; }
+  const Subject* end() const { return data_ + size_; }
+
+  void reserve(size_t capacity) {
+    if (capacity > capacity_)
+      Reallocate(capacity);
+  }
+
+  void push_back(const Subject& subject) {
+    if (size_ == capacity_)
+      Reallocate(std::max<size_t>(2 * capacity_, kMinCapacity));
+    data_[size_++] = subject;
+  }
+
+  template <typename... Args>
+  void emplace_back(Args&&... args) {
+    push_back(Subject(std::forward<Args>(args)...));
+  }
+
+  void resize(size_t size, const Subject& subject) {
+    reserve(size);
+    std::fill(data_ + std::min(size_, size), data_ + size, subject);
+    size_ = size;
+  }
+
+  void pop_back() { --size_; }
+  void clear() { size_ = 0; }
+
+#ifndef __EMSCRIPTEN__
+  // Moves the subjects into the file at |path|, which is created or
+  // truncated, and keeps them there from then on. Returns false if the file
+  // cannot be opened or mapped, in which case the store stays on the heap.
+  bool MapFile(const std::string& path) {
+    assert(fd_ < 0);
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      return false;
+    Subject* heap_data = data_;
+    const size_t heap_capacity = capacity_;
+    data_ = nullptr;
+    capacity_ = 0;
+    fd_ = fd;
+    try {
+      Reallocate(std::max(heap_capacity, kMinCapacity));
+    } catch (const std::bad_alloc&) {
+      close(fd_);
+      fd_ = -1;
+      data_ = heap_data;
+      capacity_ = heap_capacity;
+      return false;
+    }
+    std::copy(heap_data, heap_data + size_, data_);
+    std::free(heap_data);
+    return true;
+  }
+
+  // Replaces the subjects with the contents of the file at |path|, as left
+  // behind by a store that used MapFile(). The file is mapped copy-on-write,
+  // so it is read lazily and never modified; pages that change are copied
+  // into memory. The store moves to the heap once it grows beyond the file.
+  // Returns false if the file cannot be read or does not hold whole
+  // subjects, in which case the store is unchanged.
+  bool MapExistingFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size % sizeof(Subject)) {
+      close(fd);
+      return false;
+    }
+    const size_t size = file_stat.st_size / sizeof(Subject);
+    void* mapping = MAP_FAILED;
+    if (size > 0) {
+      mapping = mmap(nullptr, file_stat.st_size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE, fd, 0);
+      if (mapping == MAP_FAILED) {
+        close(fd);
+        return false;
+      }
+    }
+    Deallocate();
+    if (size == 0) {
+      close(fd);
+      data_ = nullptr;
+      fd_ = -1;
+    } else {
+      data_ = static_cast<Subject*>(mapping);
+      fd_ = fd;
+    }
+    size_ = size;
+    capacity_ = size;
+    copy_on_write_ = size > 0;
+    return true;
+  }
+#endif
+
+  // Hints that subjects [begin, end) are about to be accessed, so that a
+  // file-backed store can start reading them in.
+  void WillNeed(size_t begin, size_t end) const {
+#ifndef __EMSCRIPTEN__
+    end = std::min(end, size_);
+    if (fd_ < 0 || begin >= end)
+      return;
+    const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    const uintptr_t first = reinterpret_cast<uintptr_t>(data_ + begin);
+    const uintptr_t last = reinterpret_cast<uintptr_t>(data_ + end);
+    const uintptr_t aligned_first = first / page_size * page_size;
+    madvise(reinterpret_cast<void*>(aligned_first), last - aligned_first,
+            MADV_WILLNEED);
+#endif
+  }
+
+private:
+  static constexpr size_t kMinCapacity = 1024;
+
+  void Reallocate(size_t capacity) {
+#ifndef __EMSCRIPTEN__
+    if (copy_on_write_) {
+      // Growing would write to the file, so move to the heap instead.
+      Subject* data =
+          static_cast<Subject*>(std::malloc(capacity * sizeof(Subject)));
+      if (!data)
+        throw std::bad_alloc();
+      std::copy(data_, data_ + size_, data);
+      Deallocate();
+      data_ = data;
+      capacity_ = capacity;
+      fd_ = -1;
+      copy_on_write_ = false;
+      return;
+    }
+    if (fd_ >= 0) {
+      // The file holds the data, so the old mapping can simply be replaced
+      // by a larger one. It is only unmapped once the new one exists, so a
+      // failure leaves the store as it was.
+      const size_t bytes = capacity * sizeof(Subject);
+      void* mapping = MAP_FAILED;
+      if (ftruncate(fd_, bytes) == 0) {
+        mapping =
+            mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+      }
+      if (mapping == MAP_FAILED)
+        throw std::bad_alloc();
+      if (data_)
+        munmap(data_, capacity_ * sizeof(Subject));
+      data_ = static_cast<Subject*>(mapping);
+      capacity_ = capacity;
+      return;
+    }
+#endif
+    void* data = std::realloc(data_, capacity * sizeof(Subject));
+    if (!data)
+      throw std::bad_alloc();
+    data_ = static_cast<Subject*>(data);
+    capacity_ = capacity;
+  }
+
+  void Deallocate() {
+#ifndef __EMSCRIPTEN__
+    if (fd_ >= 0) {
+      if (data_)
+        munmap(data_, capacity_ * sizeof(Subject));
+      // Drop the spare capacity so that the file holds just the subjects.
+      if (!copy_on_write_ && ftruncate(fd_, size_ * sizeof(Subject)) != 0)
+        std::cerr << "Failed to trim the subject file.";
+      close(fd_);
+      return;
+    }
+#endif
+    std::free(data_);
+  }
+
+  Subject* data_ = nullptr;
+  size_t size_ = 0;
+  size_t capacity_ = 0;
+  int fd_ = -1;
+  bool copy_on_write_ = false;
+};
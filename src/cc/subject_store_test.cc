@@ -0,0 +1,72 @@
+#include "subject_store.h"
+#include "gtest/gtest.h"
+#include <csignal>
+#include <cstdio>
+#include <new>
+#include <sys/resource.h>
+
+TEST(SubjectStoreTest, GrowsOnHeap) {
+  SubjectStore subjects;
+  for (int i = 0; i < 5000; ++i) {
+    subjects.emplace_back(Eigen::Vector2d(i / 5000.0, 0.5));
+  }
+  ASSERT_EQ(subjects.size(), 5000);
+  EXPECT_NEAR(subjects[1234].GetPosition()[0], 1234 / 5000.0, 1e-9);
+  subjects.pop_back();
+  EXPECT_NEAR(subjects.back().GetPosition()[0], 4998 / 5000.0, 1e-9);
+}
+
+TEST(SubjectStoreTest, KeepsSubjectsWhenMappedToFile) {
+  const std::string path = testing::TempDir() + "subject_store_test.bin";
+  SubjectStore subjects;
+  for (int i = 0; i < 100; ++i) {
+    subjects.emplace_back(Eigen::Vector2d(i / 5000.0, 0.5));
+  }
+  ASSERT_TRUE(subjects.MapFile(path));
+  // Grows the mapping a few times.
+  for (int i = 100; i < 5000; ++i) {
+    subjects.emplace_back(Eigen::Vector2d(i / 5000.0, 0.5));
+  }
+  subjects.WillNeed(0, subjects.size());
+  ASSERT_EQ(subjects.size(), 5000);
+  for (int i = 0; i < 5000; ++i) {
+    ASSERT_NEAR(subjects[i].GetPosition()[0], i / 5000.0, 1e-9);
+  }
+  std::remove(path.c_str());
+}
+
+TEST(SubjectStoreTest, KeepsMappingWhenGrowingFails) {
+  const std::string path = testing::TempDir() + "subject_store_test.bin";
+  SubjectStore subjects;
+  ASSERT_TRUE(subjects.MapFile(path));
+  // Caps the file size below the next growth, which makes ftruncate fail
+  // instead of raising SIGXFSZ.
+  rlimit original_limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &original_limit), 0);
+  rlimit limit = original_limit;
+  limit.rlim_cur = 64 * 1024;
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  const auto original_handler = std::signal(SIGXFSZ, SIG_IGN);
+  int added = 0;
+  try {
+    for (; added < 100000; ++added) {
+      subjects.emplace_back(Eigen::Vector2d(added / 100000.0, 0.5));
+    }
+  } catch (const std::bad_alloc&) {
+  }
+  std::signal(SIGXFSZ, original_handler);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &original_limit), 0);
+
+  // The store still holds everything added before the failure and can grow
+  // again.
+  ASSERT_LT(added, 100000);
+  ASSERT_EQ(subjects.size(), added);
+  for (int i = 0; i < added; ++i) {
+    ASSERT_NEAR(subjects[i].GetPosition()[0], i / 100000.0, 1e-9);
+  }
+  for (int i = 0; i < 10000; ++i) {
+    subjects.emplace_back(Eigen::Vector2d(0.5, 0.5));
+  }
+  EXPECT_EQ(subjects.size(), added + 10000);
+  std::remove(path.c_str());
+}
@@ -0,0 +1,175 @@
+#include "subject.h"
+#include "gtest/gtest.h"
+#include <cmath>
+
+namespace {
+
+// Moves every tick, in a straight line.
+SimulationConfig GetStraightMotionConfig() {
+  SimulationConfig config;
+  config.subject_angle_volatility_per_second = 0.0;
+  return config;
+}
+
+}  // namespace
+
+TEST(SubjectTest, FixedPointWrapsAround) {
+  EXPECT_EQ(Subject::ToFixedPoint(0.0), 0u);
+  EXPECT_EQ(Subject::ToFixedPoint(1.0), 0u);
+  EXPECT_EQ(Subject::ToFixedPoint(0.5), 1u << 31);
+  EXPECT_EQ(Subject::ToFixedPoint(1.5), 1u << 31);
+  EXPECT_EQ(Subject::ToFixedPoint(-0.25), 3u << 30);
+  // The largest position below 1 stays below 1.
+  EXPECT_EQ(Subject::ToFixedPoint(1.0 - std::ldexp(1.0, -32)), UINT32_MAX);
+}
+
+TEST(SubjectTest, WrapsAroundDomainEdges) {
+  const SimulationConfig config = GetStraightMotionConfig();
+  const double edge = std::ldexp(1.0, -32);
+
+  // Heading east from the right edge and west from the left edge.
+  Subject east(Eigen::Vector2d(1.0 - edge, 0.5), 0.0);
+  east.Update(1, config);
+  EXPECT_LT(east.GetPosition()[0], 0.1);
+  EXPECT_EQ(east.GetPosition()[1], 0.5);
+
+  Subject west(Eigen::Vector2d(0.0, 0.5), M_PI);
+  west.Update(1, config);
+  EXPECT_GT(west.GetPosition()[0], 0.9);
+  EXPECT_NEAR(west.GetPosition()[1], 0.5, 1e-9);
+
+  // And north and south across the other pair of edges.
+  Subject north(Eigen::Vector2d(0.5, 1.0 - edge), M_PI / 2.0);
+  north.Update(1, config);
+  EXPECT_LT(north.GetPosition()[1], 0.1);
+  EXPECT_NEAR(north.GetPosition()[0], 0.5, 1e-9);
+
+  Subject south(Eigen::Vector2d(0.5, 0.0), -M_PI / 2.0);
+  south.Update(1, config);
+  EXPECT_GT(south.GetPosition()[1], 0.9);
+}
+
+TEST(SubjectTest, HeadingRoundTrips) {
+  EXPECT_EQ(Subject::ToHeading(0.0), 0);
+  EXPECT_EQ(Subject::ToHeading(M_PI / 2.0), Subject::kHeadingSteps / 4);
+  EXPECT_EQ(Subject::ToHeading(-M_PI / 2.0), 3 * Subject::kHeadingSteps / 4);
+  EXPECT_EQ(Subject::ToHeading(2.0 * M_PI), 0);
+  EXPECT_EQ(Subject::ToHeading(5.0 * M_PI), Subject::kHeadingSteps / 2);
+
+  const double step_radians = 2.0 * M_PI / Subject::kHeadingSteps;
+  for (int heading = 0; heading < Subject::kHeadingSteps; heading += 97) {
+    EXPECT_EQ(Subject::ToHeading(heading * step_radians), heading);
+  }
+  // Angles between steps land on the nearest one.
+  for (double angle = -7.0; angle < 7.0; angle += 0.0123) {
+    const Subject subject(Eigen::Vector2d(0.5, 0.5), angle);
+    const double quantized = subject.heading_ * step_radians;
+    const double error = std::remainder(quantized - angle, 2.0 * M_PI);
+    EXPECT_LE(std::abs(error), 0.5 * step_radians + 1e-12) << angle;
+  }
+}
+
+TEST(SubjectTest, PassesThroughSeveralTransitionsInOneStep) {
+  SimulationConfig config;
+  config.days_to_symptoms = 2;
+  config.days_symptoms_to_recovery = 3;
+  const Tick ticks_to_symptoms = config.GetTicksToSymptoms();
+  const Tick ticks_with_symptoms =
+      config.GetTicksToRecovery() - config.GetTicksToSymptoms();
+
+  Subject subject(Eigen::Vector2d(0.5, 0.5));
+  subject.MaybeInfect(config);
+  EXPECT_EQ(subject.GetInfectionState(), InfectionState::kUninfected);
+  EXPECT_FALSE(subject.IsSusceptible());
+  subject.Update(1, config);
+  EXPECT_EQ(subject.GetInfectionState(),
+            InfectionState::kInfectedWithoutSymptoms);
+  EXPECT_EQ(subject.GetTicksToNextTransition(), ticks_to_symptoms - 1);
+
+  // Past the onset of symptoms, with the rest of the step counted towards
+  // recovery.
+  subject.Update(ticks_to_symptoms - 1 + 3, config);
+  EXPECT_EQ(subject.GetInfectionState(),
+            InfectionState::kInfectedWithSymptoms);
+  EXPECT_EQ(subject.GetTicksToNextTransition(), ticks_with_symptoms - 3);
+
+  subject.Update(ticks_with_symptoms - 3, config);
+  EXPECT_EQ(subject.GetInfectionState(), InfectionState::kRecovered);
+  EXPECT_EQ(subject.GetTicksToNextTransition(), std::nullopt);
+
+  // Both transitions in a single step.
+  Subject other(Eigen::Vector2d(0.5, 0.5));
+  other.MaybeInfect(config);
+  other.Update(1, config);
+  other.Update(config.GetTicksToRecovery() + 100, config);
+  EXPECT_EQ(other.GetInfectionState(), InfectionState::kRecovered);
+  EXPECT_EQ(other.GetTicksToNextTransition(), std::nullopt);
+  EXPECT_FALSE(other.IsSusceptible());
+}
+
+TEST(SubjectTest, LongStepsSpreadLikeOneTickSteps) {
+  // Moments of the moves of many subjects that start at the same spot,
+  // heading east, and move for |ticks| ticks in steps of |dt|. The turn is
+  // compared through its cosine and sine, as it wraps around.
+  struct MoveMoments {
+    double along_mean = 0.0;
+    double along_variance = 0.0;
+    double across_variance = 0.0;
+    double turn_cos_mean = 0.0;
+    double along_turn_cos = 0.0;
+    double across_turn_sin = 0.0;
+  };
+  const auto compute_move_moments = [](Tick ticks, Tick dt) {
+    constexpr int kSubjectCount = 40000;
+    const SimulationConfig config;
+    MoveMoments sums;
+    for (int i = 0; i < kSubjectCount; ++i) {
+      Subject subject(Eigen::Vector2d(0.5, 0.5), 0.0);
+      for (Tick time = 0; time < ticks; time += dt) {
+        subject.Update(dt, config);
+      }
+      const double along = subject.GetPosition()[0] - 0.5;
+      const double across = subject.GetPosition()[1] - 0.5;
+      const double turn =
+          subject.heading_ * 2.0 * M_PI / Subject::kHeadingSteps;
+      sums.along_mean += along;
+      sums.along_variance += along * along;
+      sums.across_variance += across * across;
+      sums.turn_cos_mean += std::cos(turn);
+      sums.along_turn_cos += along * std::cos(turn);
+      sums.across_turn_sin += across * std::sin(turn);
+    }
+    MoveMoments moments;
+    moments.along_mean = sums.along_mean / kSubjectCount;
+    moments.along_variance = sums.along_variance / kSubjectCount -
+                             moments.along_mean * moments.along_mean;
+    moments.across_variance = sums.across_variance / kSubjectCount;
+    moments.turn_cos_mean = sums.turn_cos_mean / kSubjectCount;
+    moments.along_turn_cos = sums.along_turn_cos / kSubjectCount;
+    moments.across_turn_sin = sums.across_turn_sin / kSubjectCount;
+    return moments;
+  };
+
+  GetRandomEngine().seed(1);
+  // One long step, and two, whose second step starts from the heading that
+  // the first one left behind.
+  for (const Tick ticks : {12, 24}) {
+    const MoveMoments expected = compute_move_moments(ticks, 1);
+    const MoveMoments actual = compute_move_moments(ticks, 12);
+    const double along_stddev = std::sqrt(expected.along_variance);
+    const double across_stddev = std::sqrt(expected.across_variance);
+    EXPECT_NEAR(actual.along_mean, expected.along_mean, 0.03 * along_stddev)
+        << ticks;
+    EXPECT_NEAR(actual.along_variance / expected.along_variance, 1.0, 0.05)
+        << ticks;
+    EXPECT_NEAR(actual.across_variance / expected.across_variance, 1.0, 0.05)
+        << ticks;
+    EXPECT_NEAR(actual.turn_cos_mean, expected.turn_cos_mean, 0.02) << ticks;
+    EXPECT_NEAR(actual.along_turn_cos, expected.along_turn_cos,
+                0.03 * along_stddev)
+        << ticks;
+    EXPECT_NEAR(actual.across_turn_sin, expected.across_turn_sin,
+                0.03 * across_stddev)
+        << ticks;
+  }
+}
@@ -0,0 +1,287 @@
+#pragma once
+#include "common.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Shared pieces of the trajectory file format that TrajectoryRecorder writes
+// and TrajectoryReader reads.
+//
+// A file starts with a header:
+//   "OBTR", version (1 byte), position bits (1 byte), keyframe interval
+//   (2 bytes).
+// It is followed by one chunk per recorded tick:
+//   payload size (4 bytes), tick (4 bytes), flags (1 byte), payload.
+// Multi-byte integers are little endian. Chunks can be skipped by their size,
+// so a reader finds every frame without decoding, and a file that ends in the
+// middle of a chunk still holds all chunks before it.
+//
+// Payloads are bit streams of columns. Subjects appear by increasing id, and
+// positions are quantized to a grid of 2^position bits cells per axis.
+// Keyframes hold every column in full. Other frames hold the ids that left
+// and joined since the previous frame, the per-subject change of each
+// coordinate, and the few subjects whose state changed. Small values are
+// Rice coded: a unary quotient followed by |k| low bits, with |k| chosen per
+// column.
+
+constexpr char kTrajectoryMagic[4] = {'O', 'B', 'T', 'R'};
+constexpr int kTrajectoryVersion = 1;
+constexpr int kTrajectoryHeaderSize = 8;
+constexpr int kTrajectoryChunkHeaderSize = 9;
+constexpr uint8_t kTrajectoryKeyframeFlag = 1;
+
+// 1/512 of the domain, about 0.4 times the default infection distance. With
+// the default motion, subjects then take about 0.65 bytes per tick; every
+// further bit adds about 0.25.
+constexpr int kDefaultTrajectoryPositionBits = 9;
+// 1/4096 of the domain, finer than a subject's move of about 1e-3 per tick,
+// for replays that need the hourly motion. Costs about 1.4 bytes per tick.
+constexpr int kFineTrajectoryPositionBits = 12;
+constexpr int kDefaultTrajectoryKeyframeInterval = 64;
+constexpr int kMaxTrajectoryPositionBits = 24;
+
+// Bits per InfectionState.
+constexpr int kTrajectoryStateBits = 2;
+static_assert(kNumInfectionStates <= (1 << kTrajectoryStateBits),
+              "Infection states do not fit into the state column.");
+
+// Bits of the per-column Rice parameter.
+constexpr int kRiceParameterBits = 5;
+// Quotients from here on are written as an escape followed by the raw value,
+// so outliers cost at most 56 bits.
+constexpr int kRiceEscapeQuotient = 24;
+
+// Cell of the position grid that |coordinate|, in [0, 1), falls into.
+inline uint32_t QuantizeCoordinate(double coordinate, int position_bits) {
+  const uint32_t mask = (uint32_t{1} << position_bits) - 1;
+  return static_cast<uint32_t>(std::floor(coordinate * (1 << position_bits))) &
+         mask;
+}
+
+inline double DequantizeCoordinate(uint32_t quantized, int position_bits) {
+  return (quantized + 0.5) / (1 << position_bits);
+}
+
+// Maps signed values to unsigned ones so that small magnitudes stay small:
+// 0, -1, 1, -2, ... become 0, 1, 2, 3, ...
+inline uint32_t ZigZagEncode(int32_t value) {
+  return (static_cast<uint32_t>(value) << 1) ^
+         static_cast<uint32_t>(value >> 31);
+}
+
+inline int32_t ZigZagDecode(uint32_t value) {
+  return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+// Change from |previous| to |current| on the wrapping grid of
+// 2^|position_bits| cells, zigzag encoded. Subjects that cross the domain
+// boundary take the short way around.
+inline uint32_t EncodeCoordinateDelta(uint32_t previous, uint32_t current,
+                                      int position_bits) {
+  const uint32_t mask = (uint32_t{1} << position_bits) - 1;
+  const uint32_t half = uint32_t{1} << (position_bits - 1);
+  const uint32_t delta = (current - previous) & mask;
+  return ZigZagEncode(delta >= half ? static_cast<int32_t>(delta) -
+                                          (int32_t{1} << position_bits)
+                                    : static_cast<int32_t>(delta));
+}
+
+inline uint32_t DecodeCoordinateDelta(uint32_t previous, uint32_t delta,
+                                      int position_bits) {
+  const uint32_t mask = (uint32_t{1} << position_bits) - 1;
+  return (previous + static_cast<uint32_t>(ZigZagDecode(delta))) & mask;
+}
+
+// Rice parameter that codes |values| in the fewest bits. Starts from the
+// bit length of their mean, which is close to optimal for the roughly
+// geometric distributions of the columns, and tries its neighbors.
+inline int ChooseRiceParameter(const std::vector<uint32_t>& values) {
+  if (values.empty())
+    return 0;
+  uint64_t sum = 0;
+  for (const uint32_t value : values) {
+    sum += value;
+  }
+  int mean_bits = 0;
+  while (mean_bits < 31 && (sum / values.size()) >> mean_bits)
+    ++mean_bits;
+  int best_k = 0;
+  uint64_t best_cost = UINT64_MAX;
+  for (int k = std::max(mean_bits - 1, 0); k <= mean_bits + 1 && k < 32; ++k) {
+    uint64_t cost = 0;
+    for (const uint32_t value : values) {
+      const uint32_t quotient = value >> k;
+      cost += quotient < kRiceEscapeQuotient ? quotient + 1 + k
+                                             : kRiceEscapeQuotient + 32;
+    }
+    if (cost < best_cost) {
+      best_cost = cost;
+      best_k = k;
+    }
+  }
+  return best_k;
+}
+
+// Appends values of up to 32 bits to a byte buffer, least significant bit
+// first.
+class BitWriter {
+public:
+  void Clear() {
+    bytes_.clear();
+    accumulator_ = 0;
+    bit_count_ = 0;
+  }
+
+  void Write(uint32_t value, int bits) {
+    assert(bits <= 32);
+    if (bits == 0)
+      return;
+    const uint64_t mask = ~uint64_t{0} >> (64 - bits);
+    accumulator_ |= (value & mask) << bit_count_;
+    bit_count_ += bits;
+    while (bit_count_ >= 8) {
+      bytes_.push_back(static_cast<uint8_t>(accumulator_));
+      accumulator_ >>= 8;
+      bit_count_ -= 8;
+    }
+  }
+
+  void WriteRice(uint32_t value, int k) {
+    const uint32_t quotient = value >> k;
+    if (quotient >= kRiceEscapeQuotient) {
+      Write((1u << kRiceEscapeQuotient) - 1, kRiceEscapeQuotient);
+      Write(value, 32);
+      return;
+    }
+    // |quotient| ones and the terminating zero.
+    Write((1u << quotient) - 1, quotient + 1);
+    Write(value, k);
+  }
+
+  // Pads the last byte with zeros and returns the buffer.
+  const std::vector<uint8_t>& Finish() {
+    if (bit_count_ > 0)
+      Write(0, 8 - bit_count_);
+    return bytes_;
+  }
+
+private:
+  std::vector<uint8_t> bytes_;
+  uint64_t accumulator_ = 0;
+  int bit_count_ = 0;
+};
+
+// Reads what BitWriter wrote. Reading past the end yields zeros and sets
+// HasOverrun(), so decoders can check once at the end.
+class BitReader {
+public:
+  BitReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  uint32_t Read(int bits) {
+    assert(bits <= 32);
+    while (bit_count_ < bits) {
+      if (position_ < size_) {
+        accumulator_ |= static_cast<uint64_t>(data_[position_]) << bit_count_;
+      } else {
+        overrun_ = true;
+      }
+      ++position_;
+      bit_count_ += 8;
+    }
+    const uint64_t mask = bits == 0 ? 0 : ~uint64_t{0} >> (64 - bits);
+    const uint32_t value = static_cast<uint32_t>(accumulator_ & mask);
+    accumulator_ >>= bits;
+    bit_count_ -= bits;
+    return value;
+  }
+
+  uint32_t ReadRice(int k) {
+    uint32_t quotient = 0;
+    while (quotient < kRiceEscapeQuotient && Read(1)) {
+      ++quotient;
+    }
+    if (quotient == kRiceEscapeQuotient)
+      return Read(32);
+    return (quotient << k) | Read(k);
+  }
+
+  bool HasOverrun() const { return overrun_; }
+
+private:
+  const uint8_t* data_;
+  size_t size_;
+  size_t position_ = 0;
+  uint64_t accumulator_ = 0;
+  int bit_count_ = 0;
+  bool overrun_ = false;
+};
+
+// Columns of a frame, ordered by increasing subject id.
+struct TrajectoryColumns {
+  std::vector<SubjectIndex> ids;
+  std::vector<uint32_t> x;
+  std::vector<uint32_t> y;
+  std::vector<InfectionState> states;
+
+  size_t size() const { return ids.size(); }
+
+  void resize(size_t size) {
+    ids.resize(size);
+    x.resize(size);
+    y.resize(size);
+    states.resize(size);
+  }
+};
+
+// Slots of a subject that is in both the previous and the current frame.
+struct TrajectoryMatch {
+  size_t previous;
+  size_t current;
+};
+
+// Writes increasing |ids| as their count and the gaps between them.
+inline void WriteSortedIds(const std::vector<SubjectIndex>& ids,
+                           std::vector<uint32_t>* gaps, BitWriter* writer) {
+  gaps->resize(ids.size());
+  for (size_t i = 0; i < ids.size(); ++i) {
+    (*gaps)[i] = i == 0 ? ids[0] : ids[i] - ids[i - 1] - 1;
+  }
+  const int k = ChooseRiceParameter(*gaps);
+  writer->Write(ids.size(), 32);
+  writer->Write(k, kRiceParameterBits);
+  for (const uint32_t gap : *gaps) {
+    writer->WriteRice(gap, k);
+  }
+}
+
+// Reads what WriteSortedIds wrote. Returns false if the count is larger than
+// |max_count|, which only happens in corrupt files.
+inline bool ReadSortedIds(BitReader* reader, size_t max_count,
+                          std::vector<SubjectIndex>* ids) {
+  const uint32_t count = reader->Read(32);
+  if (count > max_count)
+    return false;
+  const int k = reader->Read(kRiceParameterBits);
+  ids->resize(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    const uint32_t gap = reader->ReadRice(k);
+    (*ids)[i] = i == 0 ? gap : (*ids)[i - 1] + gap + 1;
+  }
+  return !reader->HasOverrun();
+}
+
+inline void WriteLittleEndian(uint32_t value, int bytes, uint8_t* out) {
+  for (int i = 0; i < bytes; ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+inline uint32_t ReadLittleEndian(const uint8_t* in, int bytes) {
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; ++i) {
+    value |= static_cast<uint32_t>(in[i]) << (8 * i);
+  }
+  return value;
+}
@@ -0,0 +1,266 @@
+#pragma once
+#include "common.h"
+#include "trajectory_format.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Subjects of one recorded tick, ordered by increasing id.
+class TrajectoryFrame {
+public:
+  Tick GetTick() const { return tick_; }
+  size_t size() const { return columns_.size(); }
+
+  SubjectIndex GetSubjectId(size_t slot) const { return columns_.ids[slot]; }
+
+  // Center of the grid cell that the subject was recorded in.
+  Eigen::Vector2d GetPosition(size_t slot) const {
+    return Eigen::Vector2d(
+        DequantizeCoordinate(columns_.x[slot], position_bits_),
+        DequantizeCoordinate(columns_.y[slot], position_bits_));
+  }
+
+  InfectionState GetInfectionState(size_t slot) const {
+    return columns_.states[slot];
+  }
+
+  // Slot of the subject with |id|, or -1 if it was not recorded.
+  int64_t FindSubject(SubjectIndex id) const {
+    const auto it =
+        std::lower_bound(columns_.ids.begin(), columns_.ids.end(), id);
+    if (it == columns_.ids.end() || *it != id)
+      return -1;
+    return it - columns_.ids.begin();
+  }
+
+private:
+  friend class TrajectoryReader;
+
+  Tick tick_ = 0;
+  int position_bits_ = 0;
+  TrajectoryColumns columns_;
+};
+
+// Reads files written by TrajectoryRecorder. Open() indexes the chunks
+// without decoding them. Decoding a frame starts from the last keyframe
+// before it, unless the reader is already between the two, so playback in
+// order decodes every frame once and a seek decodes at most a keyframe
+// interval of frames.
+class TrajectoryReader {
+public:
+  // Returns false if |path| cannot be read or is not a trajectory file. A
+  // chunk cut off at the end of the file, e.g. by a crash, is ignored.
+  bool Open(const std::string& path) {
+    file_.close();
+    file_.clear();
+    file_.open(path, std::ios::binary);
+    uint8_t header[kTrajectoryHeaderSize];
+    if (!file_.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+        !std::equal(kTrajectoryMagic, kTrajectoryMagic + 4, header) ||
+        header[4] != kTrajectoryVersion || header[5] < 1 ||
+        header[5] > kMaxTrajectoryPositionBits) {
+      return false;
+    }
+    position_bits_ = header[5];
+
+    file_.seekg(0, std::ios::end);
+    const int64_t file_size = file_.tellg();
+    chunks_.clear();
+    int64_t offset = sizeof(header);
+    uint8_t chunk_header[kTrajectoryChunkHeaderSize];
+    while (offset + kTrajectoryChunkHeaderSize <= file_size) {
+      file_.seekg(offset);
+      if (!file_.read(reinterpret_cast<char*>(chunk_header),
+                      sizeof(chunk_header))) {
+        break;
+      }
+      const uint32_t payload_size = ReadLittleEndian(chunk_header, 4);
+      const int64_t payload_offset = offset + kTrajectoryChunkHeaderSize;
+      if (payload_offset + payload_size > file_size)
+        break;
+      const bool keyframe = chunk_header[8] & kTrajectoryKeyframeFlag;
+      // A file must start with a keyframe to be decodable.
+      if (chunks_.empty() && !keyframe)
+        return false;
+      chunks_.push_back(Chunk{ReadLittleEndian(chunk_header + 4, 4),
+                              payload_offset, payload_size, keyframe});
+      offset = payload_offset + payload_size;
+    }
+    file_.clear();
+    decoded_chunk_ = -1;
+    return true;
+  }
+
+  int GetFrameCount() const { return chunks_.size(); }
+  Tick GetFrameTick(int frame) const { return chunks_[frame].tick; }
+  int GetPositionBits() const { return position_bits_; }
+
+  // Decodes the last frame recorded at or before |tick| into |frame|.
+  // Returns false if there is none or the file is corrupt.
+  bool SeekToTick(Tick tick, TrajectoryFrame* frame) {
+    const auto it = std::upper_bound(
+        chunks_.begin(), chunks_.end(), tick,
+        [](Tick tick, const Chunk& chunk) { return tick < chunk.tick; });
+    if (it == chunks_.begin())
+      return false;
+    return ReadFrame(it - chunks_.begin() - 1, frame);
+  }
+
+  // Decodes frame number |frame|, counting from 0.
+  bool ReadFrame(int frame, TrajectoryFrame* result) {
+    if (frame < 0 || frame >= chunks_.size())
+      return false;
+    int keyframe = frame;
+    while (!chunks_[keyframe].keyframe) {
+      --keyframe;
+    }
+    int next = decoded_chunk_ >= keyframe && decoded_chunk_ <= frame
+                   ? decoded_chunk_ + 1
+                   : keyframe;
+    for (; next <= frame; ++next) {
+      if (!DecodeChunk(next)) {
+        decoded_chunk_ = -1;
+        return false;
+      }
+      decoded_chunk_ = next;
+    }
+    result->tick_ = chunks_[frame].tick;
+    result->position_bits_ = position_bits_;
+    result->columns_ = frame_;
+    return true;
+  }
+
+private:
+  struct Chunk {
+    Tick tick;
+    int64_t payload_offset;
+    uint32_t payload_size;
+    bool keyframe;
+  };
+
+  // Decodes chunk |index| into |frame_|, which must hold the chunk before it
+  // unless it is a keyframe.
+  bool DecodeChunk(int index) {
+    const Chunk& chunk = chunks_[index];
+    payload_.resize(chunk.payload_size);
+    file_.seekg(chunk.payload_offset);
+    if (!file_.read(reinterpret_cast<char*>(payload_.data()),
+                    payload_.size())) {
+      file_.clear();
+      return false;
+    }
+    BitReader reader(payload_.data(), payload_.size());
+    const bool decoded = chunk.keyframe ? DecodeKeyframe(&reader)
+                                        : DecodeDeltaFrame(&reader);
+    return decoded && !reader.HasOverrun();
+  }
+
+  // Largest count a payload of |reader|'s size could hold, to reject corrupt
+  // counts before allocating for them.
+  size_t GetMaxCount() const {
+    return static_cast<size_t>(payload_.size()) * 8;
+  }
+
+  bool DecodeKeyframe(BitReader* reader) {
+    if (!ReadSortedIds(reader, GetMaxCount(), &frame_.ids))
+      return false;
+    frame_.resize(frame_.ids.size());
+    for (uint32_t& x : frame_.x) {
+      x = reader->Read(position_bits_);
+    }
+    for (uint32_t& y : frame_.y) {
+      y = reader->Read(position_bits_);
+    }
+    for (InfectionState& state : frame_.states) {
+      state = static_cast<InfectionState>(reader->Read(kTrajectoryStateBits));
+    }
+    return true;
+  }
+
+  // Mirrors TrajectoryRecorder::EncodeDeltaFrame: drops the subjects that
+  // left, merges in those that joined, then applies the changes to those who
+  // stayed, in id order.
+  bool DecodeDeltaFrame(BitReader* reader) {
+    if (!ReadSortedIds(reader, frame_.size(), &removed_ids_) ||
+        !ReadSortedIds(reader, GetMaxCount(), &added_ids_)) {
+      return false;
+    }
+    std::swap(previous_, frame_);
+    frame_.resize(previous_.size() - removed_ids_.size() + added_ids_.size());
+    stayed_.clear();
+    size_t p = 0;
+    size_t removed = 0;
+    size_t added = 0;
+    const auto skip_removed = [&] {
+      while (p < previous_.size() && removed < removed_ids_.size() &&
+             previous_.ids[p] == removed_ids_[removed]) {
+        ++p;
+        ++removed;
+      }
+    };
+    for (size_t c = 0; c < frame_.size(); ++c) {
+      skip_removed();
+      if (added < added_ids_.size() &&
+          (p == previous_.size() || added_ids_[added] < previous_.ids[p])) {
+        frame_.ids[c] = added_ids_[added];
+        frame_.x[c] = reader->Read(position_bits_);
+        frame_.y[c] = reader->Read(position_bits_);
+        frame_.states[c] =
+            static_cast<InfectionState>(reader->Read(kTrajectoryStateBits));
+        ++added;
+      } else if (p < previous_.size()) {
+        frame_.ids[c] = previous_.ids[p];
+        frame_.states[c] = previous_.states[p];
+        stayed_.push_back({p++, c});
+      } else {
+        return false;
+      }
+    }
+    skip_removed();
+    if (removed != removed_ids_.size() || added != added_ids_.size())
+      return false;
+
+    // The recorder writes each column over the subjects who stayed.
+    DecodeCoordinateColumn(reader, previous_.x, &frame_.x);
+    DecodeCoordinateColumn(reader, previous_.y, &frame_.y);
+
+    const uint32_t change_count = reader->Read(32);
+    if (change_count > stayed_.size())
+      return false;
+    const int k = reader->Read(kRiceParameterBits);
+    size_t i = 0;
+    for (uint32_t change = 0; change < change_count; ++change) {
+      i += reader->ReadRice(k);
+      if (i >= stayed_.size())
+        return false;
+      frame_.states[stayed_[i].current] =
+          static_cast<InfectionState>(reader->Read(kTrajectoryStateBits));
+      ++i;
+    }
+    return true;
+  }
+
+  void DecodeCoordinateColumn(BitReader* reader,
+                              const std::vector<uint32_t>& previous,
+                              std::vector<uint32_t>* current) {
+    const int k = reader->Read(kRiceParameterBits);
+    for (size_t i = 0; i < stayed_.size(); ++i) {
+      (*current)[stayed_[i].current] = DecodeCoordinateDelta(
+          previous[stayed_[i].previous], reader->ReadRice(k), position_bits_);
+    }
+  }
+
+  std::ifstream file_;
+  int position_bits_ = 0;
+  std::vector<Chunk> chunks_;
+  // Chunk that |frame_| holds, or -1.
+  int decoded_chunk_ = -1;
+  TrajectoryColumns frame_;
+  TrajectoryColumns previous_;
+  std::vector<uint8_t> payload_;
+  std::vector<SubjectIndex> removed_ids_;
+  std::vector<SubjectIndex> added_ids_;
+  std::vector<TrajectoryMatch> stayed_;
+};
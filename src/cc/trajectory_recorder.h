@@ -0,0 +1,331 @@
+#pragma once
+#include "common.h"
+#include "subject_store.h"
+#include "trajectory_format.h"
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams the positions and infection states of all subjects into a
+// trajectory file (see trajectory_format.h), one frame per recorded tick, for
+// archiving whole runs. Record() only copies the subjects into one of a fixed
+// number of buffers; sorting, encoding and writing happen on a background
+// thread. If the writer falls behind, Record() waits for a free buffer, so
+// memory stays bounded however long the run.
+//
+// Positions are stored to 2^-position_bits, and subjects are identified by
+// their stable ids, so frames stay comparable across reorders and population
+// changes. With the default resolution and motion, a frame takes well under
+// a byte per subject. Replays that need the hourly motion can pass
+// kFineTrajectoryPositionBits instead.
+class TrajectoryRecorder {
+public:
+  explicit TrajectoryRecorder(
+      int position_bits = kDefaultTrajectoryPositionBits,
+      int keyframe_interval = kDefaultTrajectoryKeyframeInterval)
+      : position_bits_(position_bits), keyframe_interval_(keyframe_interval) {
+    assert(position_bits >= 1 && position_bits <= kMaxTrajectoryPositionBits);
+    assert(keyframe_interval >= 1 && keyframe_interval <= 0xffff);
+  }
+
+  ~TrajectoryRecorder() { Close(); }
+
+  TrajectoryRecorder(const TrajectoryRecorder&) = delete;
+  TrajectoryRecorder& operator=(const TrajectoryRecorder&) = delete;
+
+  // Creates or truncates the file at |path| and starts the writer. Returns
+  // false if the file cannot be written.
+  bool Open(const std::string& path) {
+    assert(!writer_.joinable());
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    uint8_t header[kTrajectoryHeaderSize];
+    std::copy(kTrajectoryMagic, kTrajectoryMagic + 4, header);
+    header[4] = kTrajectoryVersion;
+    header[5] = position_bits_;
+    WriteLittleEndian(keyframe_interval_, 2, header + 6);
+    file_.write(reinterpret_cast<const char*>(header), sizeof(header));
+    if (!file_)
+      return false;
+    bytes_written_ = sizeof(header);
+    failed_ = false;
+    frame_count_ = 0;
+    stopping_ = false;
+    for (int i = 0; i < kBufferCount; ++i) {
+      free_buffers_.push_back(&buffers_[i]);
+    }
+    writer_ = std::thread([this] { WriterLoop(); });
+    return true;
+  }
+
+  // Records the subjects as of |tick|. id_of(index) returns the stable id of
+  // the subject at |index|, e.g. Simulation::GetSubjectId. Ticks should
+  // increase from call to call.
+  template <typename IdFn>
+  void Record(Tick tick, const SubjectStore& subjects, const IdFn& id_of) {
+    assert(writer_.joinable());
+    Capture* capture;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      buffer_freed_.wait(lock, [this] { return !free_buffers_.empty(); });
+      capture = free_buffers_.back();
+      free_buffers_.pop_back();
+    }
+    capture->tick = tick;
+    capture->columns.resize(subjects.size());
+    for (SubjectIndex i = 0; i < subjects.size(); ++i) {
+      const Subject& subject = subjects[i];
+      const Eigen::Vector2d position = subject.GetPosition();
+      capture->columns.ids[i] = id_of(i);
+      capture->columns.x[i] = QuantizeCoordinate(position[0], position_bits_);
+      capture->columns.y[i] = QuantizeCoordinate(position[1], position_bits_);
+      capture->columns.states[i] = subject.GetInfectionState();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      pending_captures_.push_back(capture);
+    }
+    capture_pending_.notify_one();
+  }
+
+  // Writes the remaining frames and closes the file. Returns false if any
+  // write failed.
+  bool Close() {
+    if (!writer_.joinable())
+      return !failed_;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    capture_pending_.notify_one();
+    writer_.join();
+    free_buffers_.clear();
+    file_.close();
+    if (!file_)
+      failed_ = true;
+    return !failed_;
+  }
+
+  // Size of the file so far, including frames that are still being written.
+  // Exact once Close() returned.
+  int64_t GetBytesWritten() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_written_;
+  }
+
+private:
+  // Subjects copied in index order by Record().
+  struct Capture {
+    Tick tick = 0;
+    TrajectoryColumns columns;
+  };
+
+  // Enough for the writer to work on one frame while the simulation fills
+  // the next.
+  static constexpr int kBufferCount = 3;
+  static constexpr SubjectIndex kNoIndex =
+      std::numeric_limits<SubjectIndex>::max();
+
+  void WriterLoop() {
+    while (true) {
+      Capture* capture;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        capture_pending_.wait(lock, [this] {
+          return stopping_ || !pending_captures_.empty();
+        });
+        if (pending_captures_.empty())
+          return;
+        capture = pending_captures_.front();
+        pending_captures_.pop_front();
+      }
+      SortById(capture->columns, &current_);
+      const Tick tick = capture->tick;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_buffers_.push_back(capture);
+      }
+      buffer_freed_.notify_one();
+      WriteFrame(tick);
+    }
+  }
+
+  // Orders |columns| by id, scattering them through a table indexed by id.
+  // Ids are dense, since simulations hand them out consecutively.
+  void SortById(const TrajectoryColumns& columns, TrajectoryColumns* sorted) {
+    SubjectIndex max_id = 0;
+    for (const SubjectIndex id : columns.ids) {
+      max_id = std::max(max_id, id);
+    }
+    index_of_id_.assign(columns.size() > 0 ? max_id + size_t{1} : 0,
+                        kNoIndex);
+    for (SubjectIndex i = 0; i < columns.size(); ++i) {
+      index_of_id_[columns.ids[i]] = i;
+    }
+    sorted->resize(columns.size());
+    size_t slot = 0;
+    for (SubjectIndex id = 0; id < index_of_id_.size(); ++id) {
+      const SubjectIndex index = index_of_id_[id];
+      if (index == kNoIndex)
+        continue;
+      sorted->ids[slot] = id;
+      sorted->x[slot] = columns.x[index];
+      sorted->y[slot] = columns.y[index];
+      sorted->states[slot] = columns.states[index];
+      ++slot;
+    }
+  }
+
+  void WriteFrame(Tick tick) {
+    const bool keyframe = frame_count_ % keyframe_interval_ == 0;
+    bits_.Clear();
+    if (keyframe) {
+      EncodeKeyframe();
+    } else {
+      EncodeDeltaFrame();
+    }
+    const std::vector<uint8_t>& payload = bits_.Finish();
+    uint8_t chunk_header[kTrajectoryChunkHeaderSize];
+    WriteLittleEndian(payload.size(), 4, chunk_header);
+    WriteLittleEndian(tick, 4, chunk_header + 4);
+    chunk_header[8] = keyframe ? kTrajectoryKeyframeFlag : 0;
+    file_.write(reinterpret_cast<const char*>(chunk_header),
+                sizeof(chunk_header));
+    file_.write(reinterpret_cast<const char*>(payload.data()),
+                payload.size());
+    if (!file_ && !failed_) {
+      std::cerr << "Failed to write the trajectory file." << std::endl;
+      failed_ = true;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      bytes_written_ += sizeof(chunk_header) + payload.size();
+    }
+    ++frame_count_;
+    std::swap(previous_, current_);
+  }
+
+  void EncodeKeyframe() {
+    WriteSortedIds(current_.ids, &values_, &bits_);
+    for (const uint32_t x : current_.x) {
+      bits_.Write(x, position_bits_);
+    }
+    for (const uint32_t y : current_.y) {
+      bits_.Write(y, position_bits_);
+    }
+    for (const InfectionState state : current_.states) {
+      bits_.Write(static_cast<uint32_t>(state), kTrajectoryStateBits);
+    }
+  }
+
+  // Matches the subjects against the previous frame, both ordered by id, and
+  // writes who left and joined, then the changes of those who stayed.
+  void EncodeDeltaFrame() {
+    removed_ids_.clear();
+    added_slots_.clear();
+    stayed_.clear();
+    size_t p = 0;
+    for (size_t c = 0; c < current_.size(); ++c) {
+      while (p < previous_.size() && previous_.ids[p] < current_.ids[c]) {
+        removed_ids_.push_back(previous_.ids[p++]);
+      }
+      if (p < previous_.size() && previous_.ids[p] == current_.ids[c]) {
+        stayed_.push_back({p++, c});
+      } else {
+        added_slots_.push_back(c);
+      }
+    }
+    while (p < previous_.size()) {
+      removed_ids_.push_back(previous_.ids[p++]);
+    }
+
+    WriteSortedIds(removed_ids_, &values_, &bits_);
+    added_ids_.resize(added_slots_.size());
+    for (size_t i = 0; i < added_slots_.size(); ++i) {
+      added_ids_[i] = current_.ids[added_slots_[i]];
+    }
+    WriteSortedIds(added_ids_, &values_, &bits_);
+    for (const size_t c : added_slots_) {
+      bits_.Write(current_.x[c], position_bits_);
+      bits_.Write(current_.y[c], position_bits_);
+      bits_.Write(static_cast<uint32_t>(current_.states[c]),
+                  kTrajectoryStateBits);
+    }
+
+    EncodeCoordinateColumn(previous_.x, current_.x);
+    EncodeCoordinateColumn(previous_.y, current_.y);
+
+    // States rarely change, so only the changes are listed, as gaps between
+    // the positions of the changed subjects among those who stayed.
+    values_.clear();
+    state_changes_.clear();
+    size_t last_change = 0;
+    for (size_t i = 0; i < stayed_.size(); ++i) {
+      const InfectionState state = current_.states[stayed_[i].current];
+      if (state == previous_.states[stayed_[i].previous])
+        continue;
+      values_.push_back(i - last_change);
+      state_changes_.push_back(state);
+      last_change = i + 1;
+    }
+    const int k = ChooseRiceParameter(values_);
+    bits_.Write(values_.size(), 32);
+    bits_.Write(k, kRiceParameterBits);
+    for (size_t i = 0; i < values_.size(); ++i) {
+      bits_.WriteRice(values_[i], k);
+      bits_.Write(static_cast<uint32_t>(state_changes_[i]),
+                  kTrajectoryStateBits);
+    }
+  }
+
+  void EncodeCoordinateColumn(const std::vector<uint32_t>& previous,
+                              const std::vector<uint32_t>& current) {
+    values_.resize(stayed_.size());
+    for (size_t i = 0; i < stayed_.size(); ++i) {
+      values_[i] = EncodeCoordinateDelta(previous[stayed_[i].previous],
+                                         current[stayed_[i].current],
+                                         position_bits_);
+    }
+    const int k = ChooseRiceParameter(values_);
+    bits_.Write(k, kRiceParameterBits);
+    for (const uint32_t value : values_) {
+      bits_.WriteRice(value, k);
+    }
+  }
+
+  const int position_bits_;
+  const int keyframe_interval_;
+
+  std::ofstream file_;
+  std::thread writer_;
+  mutable std::mutex mutex_;
+  std::condition_variable capture_pending_;
+  std::condition_variable buffer_freed_;
+  Capture buffers_[kBufferCount];
+  // Guarded by |mutex_|.
+  std::vector<Capture*> free_buffers_;
+  std::deque<Capture*> pending_captures_;
+  bool stopping_ = false;
+  int64_t bytes_written_ = 0;
+
+  // Only used by the writer thread while it runs.
+  bool failed_ = false;
+  int64_t frame_count_ = 0;
+  TrajectoryColumns previous_;
+  TrajectoryColumns current_;
+  std::vector<SubjectIndex> index_of_id_;
+  BitWriter bits_;
+  std::vector<uint32_t> values_;
+  std::vector<SubjectIndex> removed_ids_;
+  std::vector<SubjectIndex> added_ids_;
+  std::vector<size_t> added_slots_;
+  std::vector<TrajectoryMatch> stayed_;
+  std::vector<InfectionState> state_changes_;
+};
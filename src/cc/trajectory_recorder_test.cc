@@ -0,0 +1,112 @@
+#include "simulation.h"
+#include "trajectory_reader.h"
+#include "trajectory_recorder.h"
+#include "gtest/gtest.h"
+#include <cstdio>
+#include <map>
+#include <tuple>
+
+namespace {
+
+// Quantized position and state by subject id.
+using ExpectedFrame = std::map<SubjectIndex, std::tuple<int, int, int>>;
+
+ExpectedFrame GetExpectedFrame(const Simulation& simulation,
+                               int position_bits) {
+  ExpectedFrame expected;
+  const SubjectStore& subjects = simulation.GetSubjects();
+  for (SubjectIndex i = 0; i < subjects.size(); ++i) {
+    const Eigen::Vector2d position = subjects[i].GetPosition();
+    expected[simulation.GetSubjectId(i)] = {
+        std::floor(position[0] * (1 << position_bits)),
+        std::floor(position[1] * (1 << position_bits)),
+        static_cast<int>(subjects[i].GetInfectionState())};
+  }
+  return expected;
+}
+
+ExpectedFrame GetDecodedFrame(const TrajectoryFrame& frame,
+                              int position_bits) {
+  ExpectedFrame decoded;
+  for (size_t slot = 0; slot < frame.size(); ++slot) {
+    const Eigen::Vector2d position = frame.GetPosition(slot);
+    decoded[frame.GetSubjectId(slot)] = {
+        std::floor(position[0] * (1 << position_bits)),
+        std::floor(position[1] * (1 << position_bits)),
+        static_cast<int>(frame.GetInfectionState(slot))};
+  }
+  return decoded;
+}
+
+}  // namespace
+
+TEST(TrajectoryRecorderTest, RoundTripsAndSeeks) {
+  for (const int position_bits :
+       {kDefaultTrajectoryPositionBits, kFineTrajectoryPositionBits}) {
+    const std::string path = testing::TempDir() + "trajectory_round_trip";
+    SimulationConfig config;
+    config.days_to_symptoms = 1;
+    config.days_symptoms_to_recovery = 1;
+    Simulation simulation(config);
+    simulation.Init(3000);
+    for (int i = 0; i < 10; ++i) {
+      simulation.Infect(i * 300);
+    }
+
+    std::vector<ExpectedFrame> expected_frames;
+    {
+      TrajectoryRecorder recorder(position_bits, /*keyframe_interval=*/16);
+      ASSERT_TRUE(recorder.Open(path));
+      for (int tick = 0; tick < 100; ++tick) {
+        // Subjects leave and join, and reorders change their indices.
+        if (tick % 7 == 3) {
+          simulation.RemoveSubject(tick);
+          simulation.AddSubject(Subject(Eigen::Vector2d(0.25, 0.75)));
+        }
+        simulation.Update(1);
+        recorder.Record(simulation.GetElapsedSimulationTime(),
+                        simulation.GetSubjects(), [&](SubjectIndex index) {
+                          return simulation.GetSubjectId(index);
+                        });
+        expected_frames.push_back(GetExpectedFrame(simulation, position_bits));
+      }
+      ASSERT_TRUE(recorder.Close());
+    }
+
+    TrajectoryReader reader;
+    ASSERT_TRUE(reader.Open(path));
+    ASSERT_EQ(reader.GetFrameCount(), 100);
+    TrajectoryFrame frame;
+    // Forwards, backwards into an earlier keyframe interval, and in order.
+    for (const int tick : {57, 80, 20, 21, 22, 99, 1}) {
+      ASSERT_TRUE(reader.SeekToTick(tick, &frame)) << tick;
+      EXPECT_EQ(frame.GetTick(), tick);
+      EXPECT_EQ(GetDecodedFrame(frame, position_bits),
+                expected_frames[tick - 1])
+          << position_bits << " bits, tick " << tick;
+    }
+    EXPECT_FALSE(reader.SeekToTick(0, &frame));
+    std::remove(path.c_str());
+  }
+}
+
+TEST(TrajectoryRecorderTest, TakesLessThanABytePerSubjectAndTick) {
+  const std::string path = testing::TempDir() + "trajectory_size";
+  Simulation simulation;
+  simulation.Init(20000);
+  TrajectoryRecorder recorder;
+  ASSERT_TRUE(recorder.Open(path));
+  constexpr int kTickCount = 128;
+  for (int tick = 0; tick < kTickCount; ++tick) {
+    simulation.Update(1);
+    recorder.Record(simulation.GetElapsedSimulationTime(),
+                    simulation.GetSubjects(), [&](SubjectIndex index) {
+                      return simulation.GetSubjectId(index);
+                    });
+  }
+  ASSERT_TRUE(recorder.Close());
+  const double bytes_per_subject_and_tick =
+      static_cast<double>(recorder.GetBytesWritten()) / kTickCount / 20000;
+  EXPECT_LT(bytes_per_subject_and_tick, 1.0);
+  std::remove(path.c_str());
+}
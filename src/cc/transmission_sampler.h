@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// Decides which of a sequence of independent transmission attempts succeed,
+// each with the same probability, without drawing a random number per
+// attempt. Instead the number of failures before the next success is drawn
+// from a geometric distribution and counted down, so random draws scale with
+// the number of transmissions rather than with the number of contacts.
+//
+// Only (contagious, susceptible) pairs should be fed into the sampler; any
+// other pair cannot transmit and would just consume part of the countdown.
+// Not thread-safe; use one sampler per thread.
+class TransmissionSampler {
+public:
+  explicit TransmissionSampler(double probability)
+      : log_failure_probability_(std::log1p(-probability)) {
+    DrawSkip();
+  }
+
+  // Returns whether the next attempt transmits.
+  bool Attempt() {
+    if (attempts_to_skip_ > 0) {
+      --attempts_to_skip_;
+      return false;
+    }
+    DrawSkip();
+    return true;
+  }
+
+private:
+  void DrawSkip() {
+    // Inverse CDF of the geometric distribution on {0, 1, 2, ...}.
+    const double u = 1.0 - GenerateNormalizedUniformRandomNumber();
+    const double skip = std::floor(std::log(u) / log_failure_probability_);
+    attempts_to_skip_ =
+        skip < std::numeric_limits<int64_t>::max()
+            ? static_cast<int64_t>(skip)
+            : std::numeric_limits<int64_t>::max();
+  }
+
+  double log_failure_probability_;
+  int64_t attempts_to_skip_ = 0;
+};
@@ -0,0 +1,24 @@
+#include "transmission_sampler.h"
+#include "gtest/gtest.h"
+
+TEST(TransmissionSamplerTest, SuccessRateMatchesProbability) {
+  constexpr int kNumAttempts = 1000000;
+  for (const double probability : {0.02, 0.3}) {
+    TransmissionSampler sampler(probability);
+    int num_successes = 0;
+    for (int i = 0; i < kNumAttempts; ++i) {
+      num_successes += sampler.Attempt();
+    }
+    EXPECT_NEAR(num_successes, probability * kNumAttempts,
+                0.05 * probability * kNumAttempts);
+  }
+}
+
+TEST(TransmissionSamplerTest, DegenerateProbabilities) {
+  TransmissionSampler never(0.0);
+  TransmissionSampler always(1.0);
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_FALSE(never.Attempt());
+    EXPECT_TRUE(always.Attempt());
+  }
+}
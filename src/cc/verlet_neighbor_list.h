@@ -0,0 +1,175 @@
+#pragma once
+#include "arena.h"
+#include "cell_grid.h"
+#include "subject_store.h"
+#include <cassert>
+#include <vector>
+
+// Per-subject lists of candidate neighbors within |cutoff| + |skin|, built
+// from the cell grid and reused across ticks. As long as no subject has moved
+// more than half the skin since the last build, every pair that is within
+// |cutoff| now is guaranteed to be in the lists.
+//
+// Only the infection phase reads the lists, and only for subjects in the
+// grid's active tiles, so Build and NeedsRebuild only visit the cells near
+// the tiles that are active at build time:
+//  - Contacts of a subject in an active tile lie in the tile or in the ring
+//    of cells around it. The subjects in these watched cells must all have
+//    been seen at build time and stayed within half the skin.
+//  - Lists are built for one more ring of cells, so a subject that enters
+//    the watched cells from outside, unseen, has moved more than a cell
+//    width, which exceeds half the skin and calls for a rebuild anyway.
+// A contagious subject always lies in an active tile, so no contact with one
+// is missed as long as no tile became active since the last build.
+//
+// Distances and displacements are measured on the torus, like the grid's
+// neighborhoods, so subjects that wrap around the domain boundary do not
+// invalidate the lists. The grid's cell size must be at least
+// |cutoff| + |skin|.
+class VerletNeighborList {
+public:
+  VerletNeighborList(double cutoff, double skin)
+      : cutoff_(cutoff), skin_(skin) {}
+
+  double GetSkin() const { return skin_; }
+
+  void Build(const SubjectStore& subjects,
+             const CellGrid<SubjectIndex>& grid) {
+    ++generation_;
+    subject_generations_.resize(subjects.size(), 0);
+    list_offsets_.resize(subjects.size());
+    reference_positions_.resize(subjects.size());
+    built_cell_generations_.resize(grid.GetCellCount(), 0);
+    watched_cell_generations_.resize(grid.GetCellCount(), 0);
+    is_tile_built_.assign(grid.GetTileCount(), false);
+    built_cells_.clear();
+    watched_cells_.clear();
+    candidates_.clear();
+
+    ScratchArena::Scope scratch_scope;
+    ScratchVector<int> cell_ids;
+    for (const int tile_id : grid.GetActiveTiles()) {
+      is_tile_built_[tile_id] = true;
+      grid.GetCellsAroundTile(tile_id, /*margin=*/1, &cell_ids);
+      AddNewCells(cell_ids, &watched_cell_generations_, &watched_cells_);
+      grid.GetCellsAroundTile(tile_id, /*margin=*/2, &cell_ids);
+      AddNewCells(cell_ids, &built_cell_generations_, &built_cells_);
+    }
+
+    const double radius = cutoff_ + skin_;
+    ScratchVector<SubjectIndex> neighbors;
+    for (const int cell_id : built_cells_) {
+      if (grid.GetCell(cell_id).empty())
+        continue;
+      grid.GetNeighborsOfCell(cell_id, &neighbors);
+      for (const SubjectIndex i : grid.GetCell(cell_id)) {
+        const Eigen::Vector2d position = subjects[i].GetPosition();
+        subject_generations_[i] = generation_;
+        reference_positions_[i] = position;
+        list_offsets_[i].begin = candidates_.size();
+        for (const SubjectIndex j : neighbors) {
+          if (j == i)
+            continue;
+          const Eigen::Vector2d diff =
+              WrappedDifference(position, subjects[j].GetPosition());
+          if (diff.squaredNorm() < radius * radius)
+            candidates_.push_back(j);
+        }
+        list_offsets_[i].end = candidates_.size();
+      }
+    }
+    is_valid_ = true;
+  }
+
+  // Whether the lists may miss a contact within the cutoff: a tile became
+  // active since the last Build, a watched subject has moved more than half
+  // the skin or was not seen by the last Build, or the subjects were added,
+  // removed or reordered.
+  bool NeedsRebuild(const SubjectStore& subjects,
+                    const CellGrid<SubjectIndex>& grid) const {
+    if (!is_valid_ || subjects.size() != subject_generations_.size() ||
+        is_tile_built_.size() != grid.GetTileCount()) {
+      return true;
+    }
+    for (const int tile_id : grid.GetActiveTiles()) {
+      if (!is_tile_built_[tile_id])
+        return true;
+    }
+    const double max_displacement = 0.5 * skin_;
+    for (const int cell_id : watched_cells_) {
+      for (const SubjectIndex i : grid.GetCell(cell_id)) {
+        if (subject_generations_[i] != generation_)
+          return true;
+        const Eigen::Vector2d diff = WrappedDifference(
+            subjects[i].GetPosition(), reference_positions_[i]);
+        if (diff.squaredNorm() > max_displacement * max_displacement)
+          return true;
+      }
+    }
+    return false;
+  }
+
+  // Forces the next NeedsRebuild() to return true, e.g. after subjects have
+  // been permuted.
+  void Invalidate() { is_valid_ = false; }
+
+  // Candidates of a subject in an active tile, while NeedsRebuild() is false.
+  const SubjectIndex* CandidatesBegin(SubjectIndex index) const {
+    assert(subject_generations_[index] == generation_);
+    return candidates_.data() + list_offsets_[index].begin;
+  }
+
+  const SubjectIndex* CandidatesEnd(SubjectIndex index) const {
+    return candidates_.data() + list_offsets_[index].end;
+  }
+
+private:
+  // Range of a subject's candidates in |candidates_|.
+  struct ListOffsets {
+    size_t begin = 0;
+    size_t end = 0;
+  };
+
+  // Appends the cells of |cell_ids| that are not yet stamped with the
+  // current generation to |cells|.
+  template <typename Allocator>
+  void AddNewCells(const std::vector<int, Allocator>& cell_ids,
+                   std::vector<uint32_t>* cell_generations,
+                   std::vector<int>* cells) const {
+    for (const int cell_id : cell_ids) {
+      if ((*cell_generations)[cell_id] != generation_) {
+        (*cell_generations)[cell_id] = generation_;
+        cells->push_back(cell_id);
+      }
+    }
+  }
+
+  // Shortest difference a - b on the unit torus.
+  static Eigen::Vector2d WrappedDifference(const Eigen::Vector2d& a,
+                                           const Eigen::Vector2d& b) {
+    Eigen::Vector2d diff = a - b;
+    for (int i = 0; i < 2; ++i) {
+      if (diff[i] > 0.5)
+        diff[i] -= 1.0;
+      if (diff[i] < -0.5)
+        diff[i] += 1.0;
+    }
+    return diff;
+  }
+
+  double cutoff_;
+  double skin_;
+  bool is_valid_ = false;
+  // Build count. Subjects and cells are stamped with it when a Build visits
+  // them, so nothing needs to be cleared between builds.
+  uint32_t generation_ = 0;
+  std::vector<uint32_t> subject_generations_;
+  std::vector<ListOffsets> list_offsets_;
+  std::vector<Eigen::Vector2d> reference_positions_;
+  std::vector<SubjectIndex> candidates_;
+  std::vector<uint32_t> built_cell_generations_;
+  std::vector<int> built_cells_;
+  std::vector<uint32_t> watched_cell_generations_;
+  std::vector<int> watched_cells_;
+  std::vector<bool> is_tile_built_;
+};
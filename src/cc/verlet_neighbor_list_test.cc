@@ -0,0 +1,135 @@
+#include "verlet_neighbor_list.h"
+#include "gtest/gtest.h"
+#include <cmath>
+#include <random>
+#include <set>
+
+namespace {
+
+constexpr double kCutoff = 0.005;
+constexpr double kSkin = 0.002;
+
+double WrappedSquaredDistance(const Eigen::Vector2d& a,
+                              const Eigen::Vector2d& b) {
+  Eigen::Vector2d diff = (a - b).cwiseAbs();
+  diff = diff.cwiseMin(Eigen::Vector2d::Ones() - diff);
+  return diff.squaredNorm();
+}
+
+// Neighbors of |index| within the cutoff among |candidates|.
+template <typename Iterator>
+std::set<SubjectIndex> GetContacts(const SubjectStore& subjects,
+                                   SubjectIndex index, Iterator begin,
+                                   Iterator end) {
+  std::set<SubjectIndex> contacts;
+  for (Iterator it = begin; it != end; ++it) {
+    if (*it != index &&
+        WrappedSquaredDistance(subjects[index].GetPosition(),
+                               subjects[*it].GetPosition()) <
+            kCutoff * kCutoff) {
+      contacts.insert(*it);
+    }
+  }
+  return contacts;
+}
+
+// Expects the lists to give the same contacts as the grid for every subject
+// that the infection phase visits. Returns the number of subjects checked.
+int ExpectSameContactsAsGrid(const SubjectStore& subjects,
+                             const CellGrid<SubjectIndex>& grid,
+                             const VerletNeighborList& verlet_list) {
+  int checked = 0;
+  std::vector<int> cell_ids;
+  std::vector<SubjectIndex> neighbors;
+  for (const int tile_id : grid.GetActiveTiles()) {
+    grid.GetCellsOfTile(tile_id, &cell_ids);
+    for (const int cell_id : cell_ids) {
+      if (!grid.IsNeighborhoodMarked(cell_id))
+        continue;
+      grid.GetNeighborsOfCell(cell_id, &neighbors);
+      for (const SubjectIndex i : grid.GetCell(cell_id)) {
+        EXPECT_EQ(GetContacts(subjects, i, verlet_list.CandidatesBegin(i),
+                              verlet_list.CandidatesEnd(i)),
+                  GetContacts(subjects, i, neighbors.begin(), neighbors.end()))
+            << "subject " << i;
+        ++checked;
+      }
+    }
+  }
+  return checked;
+}
+
+}  // namespace
+
+TEST(VerletNeighborListTest, FindsTheSameContactsAsTheGrid) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  std::uniform_real_distribution<double> step(-2e-4, 2e-4);
+  SubjectStore subjects;
+  for (int i = 0; i < 20000; ++i) {
+    subjects.emplace_back(Eigen::Vector2d(uniform(rng), uniform(rng)));
+  }
+  CellGrid<SubjectIndex> grid(kCutoff + kSkin);
+  grid.BulkLoad(subjects.size(), [&](SubjectIndex index) {
+    return subjects[index].GetPosition();
+  });
+  // A few marked subjects, which keep a part of the domain active.
+  constexpr SubjectIndex kMarkedCount = 10;
+  for (SubjectIndex i = 0; i < kMarkedCount; ++i) {
+    grid.AddMarkToCell(grid.GetCellIdOf(i));
+  }
+
+  VerletNeighborList verlet_list(kCutoff, kSkin);
+  int rebuilds = 0;
+  constexpr int kIterationCount = 40;
+  for (int iteration = 0; iteration < kIterationCount; ++iteration) {
+    if (verlet_list.NeedsRebuild(subjects, grid)) {
+      verlet_list.Build(subjects, grid);
+      ++rebuilds;
+    }
+    EXPECT_GT(ExpectSameContactsAsGrid(subjects, grid, verlet_list), 0);
+
+    for (SubjectIndex i = 0; i < subjects.size(); ++i) {
+      const Eigen::Vector2d moved =
+          subjects[i].GetPosition() + Eigen::Vector2d(step(rng), step(rng));
+      subjects[i] = Subject(Eigen::Vector2d(moved[0] - std::floor(moved[0]),
+                                            moved[1] - std::floor(moved[1])));
+      const int old_cell_id = grid.GetCellIdOf(i);
+      if (grid.Move(i, subjects[i].GetPosition()) && i < kMarkedCount) {
+        grid.RemoveMarkFromCell(old_cell_id);
+        grid.AddMarkToCell(grid.GetCellIdOf(i));
+      }
+    }
+  }
+  // The lists were reused between rebuilds, and rebuilt as subjects moved.
+  EXPECT_GT(rebuilds, 1);
+  EXPECT_LT(rebuilds, kIterationCount / 2);
+}
+
+TEST(VerletNeighborListTest, RebuildsWhenATileBecomesActive) {
+  SubjectStore subjects;
+  subjects.emplace_back(Eigen::Vector2d(0.1, 0.1));
+  subjects.emplace_back(Eigen::Vector2d(0.101, 0.1));
+  subjects.emplace_back(Eigen::Vector2d(0.9, 0.9));
+  subjects.emplace_back(Eigen::Vector2d(0.901, 0.9));
+  CellGrid<SubjectIndex> grid(kCutoff + kSkin);
+  grid.BulkLoad(subjects.size(), [&](SubjectIndex index) {
+    return subjects[index].GetPosition();
+  });
+  grid.AddMarkToCell(grid.GetCellIdOf(0));
+
+  VerletNeighborList verlet_list(kCutoff, kSkin);
+  EXPECT_TRUE(verlet_list.NeedsRebuild(subjects, grid));
+  verlet_list.Build(subjects, grid);
+  EXPECT_FALSE(verlet_list.NeedsRebuild(subjects, grid));
+  EXPECT_EQ(verlet_list.CandidatesEnd(0) - verlet_list.CandidatesBegin(0), 1);
+
+  grid.AddMarkToCell(grid.GetCellIdOf(2));
+  EXPECT_TRUE(verlet_list.NeedsRebuild(subjects, grid));
+  verlet_list.Build(subjects, grid);
+  EXPECT_FALSE(verlet_list.NeedsRebuild(subjects, grid));
+  EXPECT_EQ(*verlet_list.CandidatesBegin(3), 2);
+
+  verlet_list.Invalidate();
+  EXPECT_TRUE(verlet_list.NeedsRebuild(subjects, grid));
+}
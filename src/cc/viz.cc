@@ -1,9 +1,13 @@
+#include "adaptive_stepper.h"
+#include "aggregate_simulation.h"
 #include "renderer.h"
 #include "simulation.h"
+#include "simulation_config.h"
 #include <emscripten.h>
 #include <functional>
+#include <cstdio>
 #include <iostream>
-#include <json/writer.h>
+#include <string>
 
 // -----------------------------------------------------------------------------
 // Interface from C++ to JS.
@@ -14,6 +18,27 @@ EM_JS(void, ReportSimulationStateJson, (const char* json), {  //
   return ccToJs_reportSimulationStateJson(UTF8ToString(json));
 });
 
+// Counts around the point the user clicked.
+EM_JS(void, ReportRegionJson, (const char* json), {  //
+  return ccToJs_reportRegionJson(UTF8ToString(json));
+});
+
+// Counts of a tile of the count pyramid that JS asked for.
+EM_JS(void, ReportCountTileJson, (const char* json), {  //
+  return ccToJs_reportCountTileJson(UTF8ToString(json));
+});
+
+// Population for the aggregate engine, or 0 to run the agent-based one.
+EM_JS(double, GetAggregatePopulation, (), {  //
+  return jsToCc_aggregatePopulation();
+});
+
+// Value of the model parameter |name| chosen by the user, or |default_value|.
+EM_JS(double, GetSimulationParameter, (const char* name, double default_value),
+      {  //
+        return jsToCc_simulationParameter(UTF8ToString(name), default_value);
+      });
+
 // -----------------------------------------------------------------------------
 // Interface from JS to C++.
 //
@@ -21,27 +46,111 @@ EM_JS(void, ReportSimulationStateJson, (const char* json), {  //
 // -----------------------------------------------------------------------------
 extern "C" {
 
-void EMSCRIPTEN_KEEPALIVE on_canvas_clicked() {
-  std::cout << "CLICKED!" << std::endl;
-}
+// |x| and |y| are the clicked position in simulation coordinates, i.e. the
+// unit square with y pointing up.
+void EMSCRIPTEN_KEEPALIVE on_canvas_clicked(double x, double y);
+
+// Changes the model parameter |name|, one of SimulationConfig's
+// kParameterNames, while the simulation runs. Returns whether the value was
+// accepted.
+int EMSCRIPTEN_KEEPALIVE set_parameter(const char* name, double value);
+
+// Asks for the counts under node (|x|, |y|) of pyramid level |level|, |depth|
+// levels further down. Level 0 is the whole map. They are reported through
+// ReportCountTileJson.
+void EMSCRIPTEN_KEEPALIVE request_count_tile(int level, int x, int y,
+                                             int depth);
 
 }
 
 // -----------------------------------------------------------------------------
 // Main implementation.
 // -----------------------------------------------------------------------------
+
+SimulationConfig GetSimulationConfig() {
+  SimulationConfig config;
+  for (const char* name : SimulationConfig::kParameterNames) {
+    config.SetParameter(
+        name, GetSimulationParameter(name, *config.GetParameter(name)));
+  }
+  if (!config.IsValid()) {
+    std::cerr << "Invalid simulation parameters, using the defaults."
+              << std::endl;
+    return SimulationConfig();
+  }
+  return config;
+}
+
+// Writes |infection_state_counts| as a JSON array into |json|, which has
+// room for |size| characters, and returns the number of characters written.
+int FormatInfectionStateHistogramJson(
+    const InfectionStateHistogram& infection_state_counts, char* json,
+    int size) {
+  int length = std::snprintf(json, size, "[");
+  for (int i = 0; i < kNumInfectionStates; ++i) {
+    length += std::snprintf(
+        json + length, size - length, "%s{\"state\":\"%s\",\"count\":%lld}",
+        i > 0 ? "," : "", InfectionStateName(static_cast<InfectionState>(i)),
+        static_cast<long long>(infection_state_counts[i]));
+  }
+  length += std::snprintf(json + length, size - length, "]");
+  return length;
+}
+
+// Reports the state of |simulation| to JS. Works for every engine with the
+// Simulation reporting interface.
+template <typename SimulationT>
+void ReportSimulationState(const SimulationT& simulation) {
+  // Assemble a JSON for consumption by JS. It is written into a fixed buffer,
+  // so reporting does not allocate.
+  char json[1024];
+  int length =
+      std::snprintf(json, sizeof(json), "{\"infectionStateHistogram\":");
+  length += FormatInfectionStateHistogramJson(
+      simulation.ComputeInfectionStateHistogram(), json + length,
+      sizeof(json) - length);
+  const double hours_elapsed =
+      simulation.GetElapsedSimulationTime() * kSecondsPerTick / 3600.0;
+  std::snprintf(json + length, sizeof(json) - length,
+                ",\"hoursElapsed\":%g}", hours_elapsed);
+  ReportSimulationStateJson(json);
+}
+
 class App {
 public:
-  App() {
-    const int subject_count = 5000;
-    renderer_.Init(subject_count);
-    simulation_.Init(subject_count);
+  virtual ~App() = default;
+  virtual void DoFrame() = 0;
+  // Changes a model parameter while the app runs. Returns false if the
+  // parameter is unknown or the value is invalid.
+  virtual bool SetParameter(const std::string& name, double value) {
+    return false;
   }
+  virtual void OnClick(const Eigen::Vector2d& position) {}
+  virtual void ReportCountTile(int level, int x, int y, int depth) {}
+};
 
-  void DoFrame() {
-    // Update simulation.
-    const Duration dt = Hours(1);
-    simulation_.Update(dt);
+// Radius of the region that a click on the canvas inspects.
+constexpr double kClickRadius = 0.05;
+
+// Deepest tile that JS can ask for at once, i.e. 16x16 nodes.
+constexpr int kMaxCountTileDepth = 4;
+
+class AgentApp : public App {
+public:
+  // Steps are one hour while the epidemic spreads. Quiet phases take steps
+  // of up to half a day, whose moves follow the hourly random walk, so that
+  // the view does not jump too far between frames.
+  explicit AgentApp(const SimulationConfig& config)
+      : config_(config),
+        simulation_(config),
+        stepper_(1, 12, 365 * kTicksPerDay) {
+    renderer_.Init(config.subject_count);
+    simulation_.Init(config.subject_count);
+  }
+
+  void DoFrame() override {
+    // Update simulation. Stops advancing after a year.
+    stepper_.Step(&simulation_);
 
     // Render.
     renderer_.RenderFrame(simulation_.GetSubjects());
@@ -50,45 +159,149 @@ public:
     static int s_iterations = 0;
     s_iterations++;
     if (s_iterations % 20 == 0) {
-      const auto infection_state_counts =
-          simulation_.ComputeInfectionStateHistogram();
-
-      // Assemble a JSON for consumption by JS.
-      Json::Value infection_state_histogram(Json::arrayValue);
-      for (int i = 0; i < infection_state_counts.size(); ++i) {
-        Json::Value entry;
-        std::stringstream ss;
-        ss << static_cast<InfectionState>(i);
-        entry["state"] = ss.str();
-        entry["count"] = infection_state_counts[i];
-        infection_state_histogram.append(entry);
+      ReportSimulationState(simulation_);
+    }
+  }
+
+  // Reports the subjects around |position| by infection state.
+  void OnClick(const Eigen::Vector2d& position) override {
+    const InfectionStateHistogram counts =
+        simulation_.CountSubjectsInRadius(position, kClickRadius);
+    char json[1024];
+    int length = std::snprintf(
+        json, sizeof(json),
+        "{\"x\":%g,\"y\":%g,\"radius\":%g,\"infectionStateHistogram\":",
+        position[0], position[1], kClickRadius);
+    length += FormatInfectionStateHistogramJson(counts, json + length,
+                                                sizeof(json) - length);
+    std::snprintf(json + length, sizeof(json) - length, "}");
+    ReportRegionJson(json);
+  }
+
+  // Reports the nodes of a pyramid tile row by row, each as an array of
+  // counts by infection state.
+  void ReportCountTile(int level, int x, int y, int depth) override {
+    // Nothing draws from the pyramid, so it is only kept up to date once JS
+    // has asked for counts.
+    if (!is_count_pyramid_enabled_) {
+      simulation_.EnableCountPyramid();
+      is_count_pyramid_enabled_ = true;
+    }
+    const CountPyramid& pyramid = simulation_.GetCountPyramid();
+    const int level_resolution =
+        level >= 0 && level < pyramid.GetLevelCount()
+            ? pyramid.GetLevelResolution(level)
+            : 0;
+    if (x < 0 || x >= level_resolution || y < 0 || y >= level_resolution ||
+        depth < 0) {
+      return;
+    }
+    pyramid.GetTile(level, x, y, std::min(depth, kMaxCountTileDepth),
+                    &count_tile_);
+    // Written into a fixed buffer like ReportSimulationState, so that
+    // panning and zooming do not allocate.
+    char* json = count_tile_json_;
+    const int size = sizeof(count_tile_json_);
+    int length =
+        std::snprintf(json, size, "{\"level\":%d,\"x\":%d,\"y\":%d,\"nodes\":[",
+                      level, x, y);
+    for (int i = 0; i < count_tile_.size(); ++i) {
+      length += std::snprintf(json + length, size - length, "%s[",
+                              i > 0 ? "," : "");
+      for (int state = 0; state < kNumInfectionStates; ++state) {
+        length += std::snprintf(json + length, size - length, "%s%lld",
+                                state > 0 ? "," : "",
+                                static_cast<long long>(count_tile_[i][state]));
       }
+      length += std::snprintf(json + length, size - length, "]");
+    }
+    std::snprintf(json + length, size - length, "]}");
+    ReportCountTileJson(json);
+  }
 
-      Json::Value root;
-      root["infectionStateHistogram"] = infection_state_histogram;
-      root["hoursElapsed"] =
-          static_cast<double>(std::chrono::duration_cast<std::chrono::hours>(
-                                  simulation_.GetElapsedSimulationTime())
-                                  .count());
-      std::stringstream ss;
-      ss << root;
-      ReportSimulationStateJson(ss.str().c_str());
+  // The population is fixed once the simulation runs.
+  bool SetParameter(const std::string& name, double value) override {
+    SimulationConfig config = config_;
+    if (name == "subject_count" || !config.SetParameter(name, value) ||
+        !config.IsValid()) {
+      return false;
     }
+    config_ = config;
+    simulation_.PublishConfig(config_);
+    return true;
   }
 
  private:
+  // Latest published config.
+  SimulationConfig config_;
   Simulation simulation_;
+  AdaptiveStepper stepper_;
+  Renderer renderer_;
+  bool is_count_pyramid_enabled_ = false;
+  std::vector<InfectionStateHistogram> count_tile_;
+  // Room for the largest tile: a header, and per node the brackets and up to
+  // 20 characters and a separator for each count.
+  char count_tile_json_[64 + (1 << (2 * kMaxCountTileDepth)) *
+                                 (3 + 21 * kNumInfectionStates)];
+};
+
+// Runs the aggregate engine for populations that are too large for agents.
+// There are no individual subjects to draw, so only the stats are reported.
+class AggregateApp : public App {
+public:
+  AggregateApp(int64_t population, const SimulationConfig& config)
+      : simulation_(kDefaultAggregateContactsPerHour, config) {
+    renderer_.Init(0);
+    simulation_.Init(population);
+  }
+
+  void DoFrame() override {
+    // A day per frame; the aggregate engine is cheap enough.
+    for (int i = 0; i < 24; ++i) {
+      simulation_.Update(1);
+    }
+    renderer_.RenderFrame({});
+    ReportSimulationState(simulation_);
+  }
+
+ private:
+  AggregateSimulation simulation_;
   Renderer renderer_;
 };
 
+// The running app, for calls from JS.
+App* g_app = nullptr;
+
+void on_canvas_clicked(double x, double y) {
+  if (g_app)
+    g_app->OnClick(Eigen::Vector2d(x, y));
+}
+
+int set_parameter(const char* name, double value) {
+  return g_app && g_app->SetParameter(name, value);
+}
+
+void request_count_tile(int level, int x, int y, int depth) {
+  if (g_app)
+    g_app->ReportCountTile(level, x, y, depth);
+}
+
 void MainLoop(void* app_voidptr) {
   App* app = static_cast<App*>(app_voidptr);
   app->DoFrame();
 }
 
 int main() {
-  App app;
-  emscripten_set_main_loop_arg(MainLoop, &app, /*fps=*/0,
+  const SimulationConfig config = GetSimulationConfig();
+  const int64_t aggregate_population = GetAggregatePopulation();
+  std::unique_ptr<App> app;
+  if (aggregate_population > 0) {
+    app = std::make_unique<AggregateApp>(aggregate_population, config);
+  } else {
+    app = std::make_unique<AgentApp>(config);
+  }
+  g_app = app.get();
+  emscripten_set_main_loop_arg(MainLoop, app.get(), /*fps=*/0,
                                /*simulate_infinite_loop=*/true);
   return EXIT_SUCCESS;
 }
@@ -0,0 +1,142 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool of worker threads for the parallel phases of
+// Simulation::Update. The threads are created once and parked between calls
+// so that each tick only pays for a wake-up, not for thread creation.
+//
+// In single-threaded builds (emscripten without -pthread) the pool has no
+// workers and ParallelFor simply runs on the calling thread.
+class WorkerPool {
+public:
+  explicit WorkerPool(int num_workers = DefaultWorkerCount()) {
+    for (int i = 0; i < num_workers; ++i) {
+      workers_.emplace_back([this] { WorkerLoop(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Number of threads that execute work, including the calling thread.
+  int GetThreadCount() const { return workers_.size() + 1; }
+
+  // Splits [0, count) into contiguous chunks and calls fn(begin, end) for
+  // each of them, distributed over all threads. Blocks until every chunk has
+  // been processed. |fn| must be safe to call concurrently. Fewer than
+  // |min_parallel_count| items run on the calling thread; callers whose
+  // items are few but expensive can lower it.
+  template <typename Fn>
+  void ParallelFor(int count, const Fn& fn,
+                   int min_parallel_count = kMinParallelCount) {
+    if (count <= 0)
+      return;
+    if (workers_.empty() || count < min_parallel_count) {
+      fn(0, count);
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_.fn = &fn;
+      job_.invoke = [](const void* fn, int begin, int end) {
+        (*static_cast<const Fn*>(fn))(begin, end);
+      };
+      job_.count = count;
+      job_.num_chunks = std::min(count, GetThreadCount() * kChunksPerThread);
+      next_chunk_ = 0;
+      busy_workers_ = workers_.size();
+      ++generation_;
+    }
+    wake_.notify_all();
+
+    RunChunks();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return busy_workers_ == 0; });
+  }
+
+  static int DefaultWorkerCount() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 0;
+#else
+    const int num_cores = std::thread::hardware_concurrency();
+    return std::max(num_cores - 1, 0);
+#endif
+  }
+
+  // Below this many items the wake-up costs more than the work.
+  static constexpr int kMinParallelCount = 256;
+
+private:
+  // Several chunks per thread so that uneven chunks (e.g. dense regions of
+  // the grid) balance out.
+  static constexpr int kChunksPerThread = 4;
+
+  struct Job {
+    const void* fn = nullptr;
+    void (*invoke)(const void* fn, int begin, int end) = nullptr;
+    int count = 0;
+    int num_chunks = 0;
+  };
+
+  void RunChunks() {
+    while (true) {
+      const int chunk = next_chunk_.fetch_add(1);
+      if (chunk >= job_.num_chunks)
+        return;
+      const int64_t count = job_.count;
+      const int begin = count * chunk / job_.num_chunks;
+      const int end = count * (chunk + 1) / job_.num_chunks;
+      job_.invoke(job_.fn, begin, end);
+    }
+  }
+
+  void WorkerLoop() {
+    uint64_t seen_generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        wake_.wait(lock, [&] {
+          return stopping_ || generation_ != seen_generation;
+        });
+        if (stopping_)
+          return;
+        seen_generation = generation_;
+      }
+      RunChunks();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--busy_workers_ == 0)
+          done_.notify_one();
+      }
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  Job job_;
+  std::atomic<int> next_chunk_{0};
+  int busy_workers_ = 0;
+  uint64_t generation_ = 0;
+  bool stopping_ = false;
+};
@@ -0,0 +1,61 @@
+#include "worker_pool.h"
+#include "gtest/gtest.h"
+#include <atomic>
+#include <memory>
+
+namespace {
+
+// Runs ParallelFor over |count| items and expects every item exactly once.
+void ExpectEachIndexOnce(WorkerPool* pool, int count) {
+  std::unique_ptr<std::atomic<int>[]> visits(new std::atomic<int>[count]);
+  for (int i = 0; i < count; ++i) {
+    visits[i] = 0;
+  }
+  pool->ParallelFor(count, [&](int begin, int end) {
+    ASSERT_LE(0, begin);
+    ASSERT_LE(begin, end);
+    ASSERT_LE(end, count);
+    for (int i = begin; i < end; ++i) {
+      ++visits[i];
+    }
+  });
+  for (int i = 0; i < count; ++i) {
+    ASSERT_EQ(visits[i], 1) << "index " << i << " of " << count;
+  }
+}
+
+}  // namespace
+
+TEST(WorkerPoolTest, CoversEveryIndexOnce) {
+  // Below and above the count at which the work is split over threads.
+  for (const int num_workers : {0, 1, 3}) {
+    WorkerPool pool(num_workers);
+    EXPECT_EQ(pool.GetThreadCount(), num_workers + 1);
+    for (const int count : {1, 7, 255, 256, 257, 1000, 100003}) {
+      ExpectEachIndexOnce(&pool, count);
+    }
+  }
+}
+
+TEST(WorkerPoolTest, IgnoresEmptyRanges) {
+  WorkerPool pool(2);
+  int calls = 0;
+  pool.ParallelFor(0, [&](int, int) { ++calls; });
+  pool.ParallelFor(-5, [&](int, int) { ++calls; });
+  EXPECT_EQ(calls, 0);
+}
+
+TEST(WorkerPoolTest, RunsRepeatedlyOnTheSamePool) {
+  WorkerPool pool(3);
+  std::atomic<int64_t> sum{0};
+  for (int round = 0; round < 200; ++round) {
+    pool.ParallelFor(10000, [&](int begin, int end) {
+      int64_t chunk_sum = 0;
+      for (int i = begin; i < end; ++i) {
+        chunk_sum += i;
+      }
+      sum += chunk_sum;
+    });
+  }
+  EXPECT_EQ(sum, 200 * (int64_t{9999} * 10000 / 2));
+}
@@ -12,6 +12,64 @@ function ccToJs_reportSimulationStateJson(json) {
   console.log("Days: " + simulationState.hoursElapsed / 24);
 }
 
+function ccToJs_reportRegionJson(json) {
+  let region = JSON.parse(json);
+  console.log(region);
+}
+
+function ccToJs_reportCountTileJson(json) {
+  let tile = JSON.parse(json);
+  console.log(tile);
+}
+
+// -----------------------------------------------------------------------------
+// Interface from JS to C++ (through WebAssembly).
+//
+// Keep in sync with viz.cc.
+// -----------------------------------------------------------------------------
+
+// Runs the aggregate engine with this many people when the page is opened
+// with ?aggregate_population=N, e.g. ?aggregate_population=300000000.
+function jsToCc_aggregatePopulation() {
+  let params = new URLSearchParams(window.location.search);
+  return Number(params.get("aggregate_population")) || 0;
+}
+
+// Model parameters can be set in the URL under their SimulationConfig names,
+// e.g. ?subject_count=20000&distance_to_infect=0.01.
+function jsToCc_simulationParameter(name, defaultValue) {
+  let params = new URLSearchParams(window.location.search);
+  let value = Number(params.get(name));
+  return params.has(name) && !isNaN(value) ? value : defaultValue;
+}
+
+// Forwards a click or tap on the canvas in simulation coordinates: the canvas
+// shows the unit square with y pointing up.
+function onCanvasClicked(event) {
+  let point = event.changedTouches ? event.changedTouches[0] : event;
+  let rect = canv.getBoundingClientRect();
+  let x = (point.clientX - rect.left) / rect.width;
+  let y = 1 - (point.clientY - rect.top) / rect.height;
+  Module._on_canvas_clicked(x, y);
+}
+
+// Changes a model parameter of the running simulation, e.g.
+// setSimulationParameter("infection_probability", 0.05). It takes effect with
+// the next tick. Returns whether the value was accepted.
+function setSimulationParameter(name, value) {
+  return Module.ccall('set_parameter', 'number', ['string', 'number'],
+                      [name, value]) !== 0;
+}
+
+// Asks for the counts by infection state under node (x, y) of the count
+// pyramid's level |level|, as a 2^depth x 2^depth tile from |depth| levels
+// further down. Level 0 is the whole map and each level doubles the
+// resolution, e.g. requestCountTile(0, 0, 0, 3) gives an 8x8 overview.
+// The simulation only starts keeping these counts with the first request.
+function requestCountTile(level, x, y, depth) {
+  Module._request_count_tile(level, x, y, depth);
+}
+
 //var svgWidth = 500;
 //var svgHeight = 300;
 //